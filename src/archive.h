@@ -0,0 +1,165 @@
+#pragma once
+#ifndef SRC_ARCHIVE_H
+#define SRC_ARCHIVE_H
+
+#include <string>
+#include <filesystem>
+#include <algorithm>
+
+#include "util.h"
+#include "trace.h"
+#include "hash.h"
+#include "resources.h"
+
+// archive dependencies, for when we only need one release of a big repo and cloning it is a waste
+// ARCHIVE [url or path] [name] [sha256]
+// the archive is downloaded into a content addressed cache:
+//     ~/.bscf/archives/<sha256>/<archive file name>
+// and then extracted into lib/name, with lib/name/.bscf-archive holding the hash it was extracted from
+// if the hash in there matches, nothing is downloaded or extracted again
+// urls can be http(s):// (needs curl), file://, or a path (relative to the project)
+
+const std::string BSCF_ARCHIVE_STAMP = ".bscf-archive";
+
+std::path archiveCacheDir() {
+    std::path dir = bscfHomeDir() / "archives";
+    std::create_directories(dir);
+    return dir;
+}
+
+std::string archiveFileName(const std::string& url) {
+    std::string name = url;
+    size_t slash = name.find_last_of("/\\");
+    if (slash != std::string::npos) name = name.substr(slash + 1);
+    size_t query = name.find_first_of("?#");
+    if (query != std::string::npos) name = name.substr(0, query);
+    if (name.empty()) name = "archive";
+    return name;
+}
+
+// the hash as it's used in paths (lowercase), empty if it isn't a sha256 (64 hex digits)
+std::string normalizeSha256(std::string hash) {
+    if (hash.size() != 64 || hash.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos) return "";
+    std::transform(hash.begin(), hash.end(), hash.begin(), ::tolower);
+    return hash;
+}
+
+bool isZipArchive(const std::string& fileName) {
+    std::string lower = fileName;
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    return lower.size() > 4 && lower.substr(lower.size() - 4) == ".zip";
+}
+
+// copy or download url into dest, returns false if we couldn't get it
+bool fetchArchive(const std::string& url, const std::path& projPath, const std::path& dest) {
+    TraceSpan span("fetch", url);
+    if (url.rfind("http://", 0) == 0 || url.rfind("https://", 0) == 0 || url.rfind("ftp://", 0) == 0) {
+        std::cout << "Downloading " << url << std::endl;
+        std::string cmd = "curl -fsSL -o " + dest.string() + " " + url + NULLIFY_CMD;
+        return runCommand(cmd) == 0 && std::exists(dest);
+    }
+    std::path src = url;
+    if (url.rfind("file://", 0) == 0) {
+        src = url.substr(7);
+    } else if (src.is_relative()) {
+        src = projPath / src;
+    }
+    std::error_code ec;
+    std::filesystem::copy_file(src, dest, std::filesystem::copy_options::overwrite_existing, ec);
+    return !ec;
+}
+
+// returns the path of the cached archive for hash, downloading it if we don't have it yet
+// returns an empty path if it couldn't be fetched or the hash didn't match
+std::path getCachedArchive(const std::string& url, const std::string& hash, const std::path& projPath) {
+    if (normalizeSha256(hash) != hash) {
+        std::cerr << "Error: invalid sha256 for " << url << ": " << hash << std::endl;
+        return "";
+    }
+    std::path entry = archiveCacheDir() / hash;
+    std::path archive = entry / archiveFileName(url);
+    if (std::exists(archive)) {
+        return archive;
+    }
+    std::create_directories(entry);
+    std::path tmp = archive;
+    tmp += ".part";
+    if (!fetchArchive(url, projPath, tmp)) {
+        std::cerr << "Error: failed to fetch " << url << std::endl;
+        std::filesystem::remove(tmp);
+        return "";
+    }
+    std::string actual = sha256File(tmp);
+    if (actual != hash) {
+        std::cerr << "Error: hash mismatch for " << url << std::endl;
+        std::cerr << "expected: " << hash << std::endl;
+        std::cerr << "got:      " << actual << std::endl;
+        std::filesystem::remove(tmp);
+        return "";
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp, archive, ec);
+    if (ec) {
+        // someone else put it there first, that's fine since it's the same content
+        std::filesystem::remove(tmp, ec);
+    }
+    return archive;
+}
+
+bool extractArchive(const std::path& archive, const std::path& dest) {
+    std::create_directories(dest);
+    std::string cmd;
+#ifdef _WIN32
+    // the tar that ships with windows handles zip as well
+    cmd = "tar -xf " + archive.string() + " -C " + dest.string() + NULLIFY_CMD;
+#else
+    if (isZipArchive(archive.filename().string())) {
+        cmd = "unzip -q -o " + archive.string() + " -d " + dest.string() + NULLIFY_CMD;
+    } else {
+        cmd = "tar -xf " + archive.string() + " -C " + dest.string() + NULLIFY_CMD;
+    }
+#endif
+    return runCommand(cmd) == 0;
+}
+
+// make sure lib/name holds the contents of the archive with this hash
+bool getArchive(const std::string& url, const std::string& name, const std::string& hash, const std::path& path) {
+    std::path libDir = path / "lib" / name;
+    if (std::exists(libDir / BSCF_ARCHIVE_STAMP) && strip(readFile(libDir / BSCF_ARCHIVE_STAMP)) == hash) {
+        return true;
+    }
+    std::path archive = getCachedArchive(url, hash, path);
+    if (archive.empty()) {
+        return false;
+    }
+    std::cout << "Extracting " << name << std::endl;
+    std::path tmp = path / "lib" / (name + ".extract");
+    try {
+        std::filesystem::remove_all(tmp);
+    } catch (...) {}
+    if (!extractArchive(archive, tmp)) {
+        std::cerr << "Error: failed to extract " << archive << std::endl;
+        return false;
+    }
+    // release archives normally have everything in one top level folder (name-1.2.3/), we don't want that
+    std::path root = tmp;
+    std::vector<std::path> top;
+    for (const auto& entry : std::directory_iterator(tmp)) {
+        top.push_back(entry.path());
+    }
+    if (top.size() == 1 && std::is_directory(top[0])) {
+        root = top[0];
+    }
+    try {
+        std::filesystem::remove_all(libDir);
+        std::filesystem::rename(root, libDir);
+        std::filesystem::remove_all(tmp);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: failed to extract " << name << std::endl;
+        std::cerr << e.what() << std::endl;
+        return false;
+    }
+    return writeFileAtomic(libDir / BSCF_ARCHIVE_STAMP, hash + "\n");
+}
+
+#endif //SRC_ARCHIVE_H
@@ -0,0 +1,149 @@
+#pragma once
+#ifndef SRC_ARTIFACTS_H
+#define SRC_ARTIFACTS_H
+
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <fstream>
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "util.h"
+#include "hash.h"
+#include "objcache.h"
+
+// whole target artifacts for third party libraries (BUILTIN, GITINCLUDE, ARCHIVE), shared by every project of the user
+//     ~/.bscf/cache/targets/ab/abcd.../
+//         libglfw.a // the output
+//         meta // sha256 of the output, how long it took to build, the include dirs it exports
+// the key is the commit (or archive hash) of the library + compiler fingerprint + the effective commands + the keys of its dependencies
+// so a new project using the same glfw commit with the same compiler and flags doesn't compile anything for it
+// outputs are restored with a hard link (or a reflink/copy where that doesn't work), cached files are read only,
+// and the builder breaks the link before any non-compile action of the target runs so the cache never gets written through
+// (relinks start from nothing, prebuild/postbuild steps get a writable copy, copies to dependents replace what's there)
+// the include dirs are recorded in meta, the headers themselves come from the checkout, which is at the same commit
+
+const std::string BSCF_ARTIFACT_VERSION = "bscf-artifact 1";
+
+// hard link, then reflink (linux), then a plain copy
+bool linkOrCloneFile(const std::path& src, const std::path& dst) {
+    std::error_code ec;
+    std::filesystem::remove(dst, ec);
+    std::filesystem::create_hard_link(src, dst, ec);
+    if (!ec) return true;
+#ifdef __linux__
+    int in = open(src.c_str(), O_RDONLY);
+    if (in >= 0) {
+        int out = open(dst.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0755);
+        bool cloned = out >= 0 && ioctl(out, FICLONE, in) == 0;
+        if (out >= 0) close(out);
+        close(in);
+        if (cloned) return true;
+        std::filesystem::remove(dst, ec);
+    }
+#endif
+    std::filesystem::copy_file(src, dst, std::filesystem::copy_options::overwrite_existing, ec);
+    return !ec;
+}
+
+// if path is a hard link into the artifact cache, replace it with nothing so whatever writes it next makes a new file
+void breakHardLink(const std::path& p) {
+    std::error_code ec;
+    if (std::exists(p, ec) && std::filesystem::hard_link_count(p, ec) > 1) {
+        std::filesystem::remove(p, ec);
+    }
+}
+
+// if path is a hard link into the artifact cache, make it a writable file of its own, for steps that change it in place
+void unshareHardLink(const std::path& p) {
+    std::error_code ec;
+    if (!std::exists(p, ec) || std::filesystem::hard_link_count(p, ec) <= 1) return;
+    std::path tmp = p;
+    tmp += ".unshare";
+    std::filesystem::copy_file(p, tmp, std::filesystem::copy_options::overwrite_existing, ec);
+    if (ec) return;
+    std::filesystem::permissions(tmp, std::filesystem::perms::owner_write, std::filesystem::perm_options::add, ec);
+    std::filesystem::rename(tmp, p, ec);
+    if (ec) std::filesystem::remove(tmp, ec);
+}
+
+std::path artifactDir(const std::string& key) {
+    return objCacheDir() / "targets" / key.substr(0, 2) / key;
+}
+
+struct ArtifactMeta {
+    std::string digest;
+    long long ms = 0;
+    std::vector<std::string> includes;
+};
+
+ArtifactMeta readArtifactMeta(const std::path& p) {
+    ArtifactMeta m;
+    std::ifstream file(p);
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.rfind("sha256 ", 0) == 0) m.digest = line.substr(7);
+        else if (line.rfind("ms ", 0) == 0) m.ms = std::atoll(line.substr(3).c_str()); // 0 if it's garbage
+        else if (line.rfind("include ", 0) == 0) m.includes.push_back(line.substr(8));
+    }
+    return m;
+}
+
+// returns true if output now holds the cached artifact for key
+bool restoreArtifact(const std::string& key, const std::path& output) {
+    BSCF_STAT_TIME(Stat::CACHE_LOOKUPS);
+    BSCF_STAT_ADD(Stat::CACHE_LOOKUPS, 1);
+    std::path dir = artifactDir(key);
+    std::path cached = dir / output.filename();
+    std::error_code ec;
+    if (!std::exists(cached, ec)) return false;
+    std::create_directories(output.parent_path());
+    if (!linkOrCloneFile(cached, output)) return false;
+    // recently used, for trimming
+    std::filesystem::last_write_time(dir, std::filesystem::file_time_type::clock::now(), ec);
+    ArtifactMeta meta = readArtifactMeta(dir / "meta");
+    objCacheStats.targetHits++;
+    objCacheStats.msSaved += meta.ms;
+    objCacheStats.bytesRestored += (long long)std::filesystem::file_size(cached, ec);
+    return true;
+}
+
+// the whole entry is put together in a temp dir and renamed into place
+void storeArtifact(const std::string& key, const std::path& output, const std::vector<std::string>& includes, long long ms) {
+    std::path dir = artifactDir(key);
+    std::error_code ec;
+    if (std::exists(dir, ec) || !std::exists(output, ec)) return;
+    std::path tmp = dir;
+    tmp += ".tmp" + std::to_string(std::random_device{}());
+    std::create_directories(tmp);
+    std::path cached = tmp / output.filename();
+    std::filesystem::copy_file(output, cached, ec);
+    if (ec) {
+        std::filesystem::remove_all(tmp, ec);
+        return;
+    }
+    std::filesystem::permissions(cached, std::filesystem::perms::owner_write | std::filesystem::perms::group_write | std::filesystem::perms::others_write,
+                                 std::filesystem::perm_options::remove, ec);
+    std::stringstream meta;
+    meta << BSCF_ARTIFACT_VERSION << std::endl;
+    meta << "sha256 " << sha256File(cached) << std::endl;
+    meta << "ms " << ms << std::endl;
+    for (const std::string& inc : includes) {
+        meta << "include " << inc << std::endl;
+    }
+    writeFileAtomic(tmp / "meta", meta.str());
+    objCacheStats.bytesStored += (long long)std::filesystem::file_size(cached, ec);
+    std::filesystem::rename(tmp, dir, ec);
+    if (ec) {
+        // someone else stored the same artifact first
+        std::filesystem::remove_all(tmp, ec);
+    }
+}
+
+#endif //SRC_ARTIFACTS_H
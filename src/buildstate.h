@@ -0,0 +1,186 @@
+#pragma once
+#ifndef SRC_BUILDSTATE_H
+#define SRC_BUILDSTATE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <filesystem>
+#include <fstream>
+#include <algorithm>
+
+#include "util.h"
+#include "hash.h"
+#include "objcache.h"
+
+// what every action of a target last ran with, build/cache/name.state
+//     bscf-state 1
+//     action <command hash> <key>
+//     out <sha256 of the output> // what it produced last time
+//     ms <milliseconds> // how long it took the last time it ran, the scheduler's cost model
+//     rss <bytes> // the most memory it took the last time it really ran (not from the cache), see resources.h
+//     in <mtime> <size> <sha256> <path> // one per input the action read
+//     iface <mtime> <size> <sha256> <path> // a shared library the link only needs the exported symbols of
+// the key is the output for compiles/archives/links/copies, and "prebuild:<hash>"/"postbuild:<hash>" for the rest
+// an action is up to date if its output exists, its command (including the compiler fingerprint) is the same,
+// and none of its inputs changed since (compiles get their inputs from the depfile, so headers count too)
+// so editing one DEFINE only recompiles that target's objects, and adding a POSTBUILD doesn't recompile anything
+// an input whose mtime/size changed but whose content didn't still counts as unchanged (early cutoff, like ninja's restat)
+// so a comment only edit recompiles one object, and if that comes out the same nothing after it runs:
+// not the link or archive, not the targets linking that, not the sources including a regenerated but identical header
+// for shared libraries it goes one step further, dependents are linked against the interface (interfaceDigest)
+// so changing the body of a function in a DLIB only recopies the .so next to them, it doesn't relink them
+
+const std::string BSCF_STATE_VERSION = "bscf-state 3";
+
+struct InputStamp {
+    std::string path;
+    long long mtime = -1; // -1 if the file doesn't exist
+    long long size = -1;
+    std::string digest = "-"; // "-" if the file doesn't exist
+    bool iface = false; // digest is interfaceDigest instead of the content
+};
+
+struct ActionState {
+    std::string cmdHash;
+    std::string outDigest = "-";
+    std::vector<InputStamp> inputs;
+    long long ms = -1; // -1 if never timed
+    long long rss = -1; // -1 if never measured
+};
+
+// what a dependent links against in a shared library: the exported symbols, their type,
+// and the size of data symbols (copy relocations bake it into the executable), but not addresses or code
+// falls back to the content if nm isn't there (or can't read it, like an msvc dll)
+std::string interfaceDigest(const std::string& p) {
+#ifdef __APPLE__
+    std::string cmd = "nm -g -U -P " + p + " 2>/dev/null";
+#elif defined(_WIN32)
+    std::string cmd = "nm -D --defined-only -P " + p + " 2>NUL";
+#else
+    std::string cmd = "nm -D --defined-only -P " + p + " 2>/dev/null";
+#endif
+    int status = 0;
+    std::string out = runCapture(cmd, &status);
+    if (status != 0 || out.empty()) return fileDigest(p);
+    std::vector<std::string> symbols;
+    std::stringstream ss(out);
+    std::string line;
+    while (std::getline(ss, line)) {
+        std::stringstream ls(line);
+        std::string name;
+        std::string type;
+        std::string value;
+        std::string size;
+        ls >> name >> type >> value >> size;
+        if (name.empty() || type.empty()) continue;
+        std::string symbol = name + " " + type;
+        if (std::string("BbDdGgRrSsVv").find(type[0]) != std::string::npos) symbol += " " + size;
+        symbols.push_back(symbol);
+    }
+    std::sort(symbols.begin(), symbols.end());
+    std::string all = "interface\n";
+    for (const std::string& symbol : symbols) {
+        all += symbol + "\n";
+    }
+    return sha256(all);
+}
+
+// mtime and size of p, false (and -1) if it isn't there
+bool statInput(const std::string& p, long long& mtime, long long& size) {
+    BSCF_STAT_TIME(Stat::FILE_STATS);
+    BSCF_STAT_ADD(Stat::FILE_STATS, 1);
+    mtime = -1;
+    size = -1;
+    std::error_code ec;
+    auto time = std::filesystem::last_write_time(p, ec);
+    if (ec) return false;
+    long long bytes = (long long)std::filesystem::file_size(p, ec);
+    if (ec) return false;
+    mtime = (long long)time.time_since_epoch().count();
+    size = bytes;
+    return true;
+}
+
+InputStamp stampInput(const std::string& p, bool iface = false) {
+    InputStamp s;
+    s.path = p;
+    s.iface = iface;
+    long long mtime;
+    long long size;
+    if (!statInput(p, mtime, size)) return s;
+    s.mtime = mtime;
+    s.size = size;
+    s.digest = iface ? interfaceDigest(p) : fileDigest(p);
+    return s;
+}
+
+std::map<std::string, ActionState> readBuildState(const std::path& p) {
+    std::map<std::string, ActionState> state;
+    std::ifstream file(p);
+    std::string line;
+    if (!std::getline(file, line) || line != BSCF_STATE_VERSION) return state;
+    ActionState* current = nullptr;
+    while (std::getline(file, line)) {
+        std::stringstream ss(line);
+        std::string kind;
+        ss >> kind;
+        if (kind == "action") {
+            std::string hash;
+            std::string key;
+            ss >> hash;
+            std::getline(ss, key);
+            if (!key.empty() && key[0] == ' ') key.erase(0, 1);
+            current = &state[key];
+            current->cmdHash = hash;
+        } else if (kind == "out" && current) {
+            ss >> current->outDigest;
+        } else if (kind == "ms" && current) {
+            ss >> current->ms;
+        } else if (kind == "rss" && current) {
+            ss >> current->rss;
+        } else if ((kind == "in" || kind == "iface") && current) {
+            InputStamp s;
+            s.iface = kind == "iface";
+            ss >> s.mtime >> s.size >> s.digest;
+            std::getline(ss, s.path);
+            if (!s.path.empty() && s.path[0] == ' ') s.path.erase(0, 1);
+            current->inputs.push_back(s);
+        }
+    }
+    return state;
+}
+
+bool writeBuildState(const std::path& p, const std::map<std::string, ActionState>& state) {
+    std::stringstream ss;
+    ss << BSCF_STATE_VERSION << std::endl;
+    for (const auto& [key, action] : state) {
+        ss << "action " << action.cmdHash << " " << key << std::endl;
+        ss << "out " << action.outDigest << std::endl;
+        if (action.ms >= 0) ss << "ms " << action.ms << std::endl;
+        if (action.rss >= 0) ss << "rss " << action.rss << std::endl;
+        for (const InputStamp& s : action.inputs) {
+            ss << (s.iface ? "iface " : "in ") << s.mtime << " " << s.size << " " << s.digest << " " << s.path << std::endl;
+        }
+    }
+    return writeFileAtomic(p, ss.str());
+}
+
+// prev is null if the action never ran
+// inputs that were only touched get their new mtime/size written back into prev, so they aren't hashed again next time
+bool actionUpToDate(ActionState* prev, const std::string& cmdHash, const std::string& output) {
+    if (!prev || prev->cmdHash != cmdHash) return false;
+    if (!output.empty() && !std::exists(output)) return false;
+    for (InputStamp& s : prev->inputs) {
+        long long mtime;
+        long long size;
+        statInput(s.path, mtime, size);
+        if (mtime == s.mtime && size == s.size) continue;
+        if (mtime == -1 || (s.iface ? interfaceDigest(s.path) : fileDigest(s.path)) != s.digest) return false;
+        s.mtime = mtime;
+        s.size = size;
+    }
+    return true;
+}
+
+#endif //SRC_BUILDSTATE_H
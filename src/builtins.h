@@ -7,9 +7,13 @@
 #include <map>
 
 #include "util.h"
+#include "recipes.h"
+#include "resources.h"
+#include "trace.h"
 
 // two types of builtins:
 // 1. builtins that have a source repo, and a seperate project file in the bscf-db (normally for projects that i didn't create)
+//    the project file is kept in the recipe store (see recipes.h) and copied into the lib folder
 // 2. builtins that are just a single repo (normally for projects that i created that already have a proj.bscf file) doesn't use the db at all
 
 
@@ -31,73 +35,61 @@ const std::map<std::string, bscfBuiltin> BSCF_BUILTINS = {
 };
 
 
-bool getBuiltin(const std::string& name, const std::path& path, int depth=100) {
+// copies the stored recipe into the lib folder, only writing it if it changed
+bool installRecipe(const std::string& name, const bscfBuiltin& builtin, const std::path& libDir) {
+    std::path recipe = resolveRecipe(name, builtin.db);
+    if (recipe.empty()) {
+        return false;
+    }
+    std::string contents = readFile(recipe);
+    if (std::exists(libDir / "proj.bscf") && readFile(libDir / "proj.bscf") == contents) {
+        return true;
+    }
+    return writeFileAtomic(libDir / "proj.bscf", contents);
+}
+
+bool getBuiltin(const std::string& name, const std::path& path) {
     if (BSCF_BUILTINS.find(name) == BSCF_BUILTINS.end()) {
         return false;
     }
     // download and put in path/lib/name
 
     const bscfBuiltin& builtin = BSCF_BUILTINS.at(name);
+    TraceSpan fetch("fetch", "git " + name);
+    fetch.arg("url", builtin.repo);
     // if exists git reset --hard and git pull
-    if (builtin.singleRepo) {
-        if (std::filesystem::exists(path / "lib" / name)) {
-            std::string cmd = "cd " + (path / "lib" / name).string() + " && git reset --hard " NULLIFY_CMD " && git pull" + NULLIFY_CMD;
-            system(cmd.c_str());
-            return true;
-        }
+    if (std::filesystem::exists(path / "lib" / name)) {
+        std::string cmd = "cd " + (path / "lib" / name).string() + " && git reset --hard " NULLIFY_CMD " && git pull" + NULLIFY_CMD;
+        runCommand(cmd);
+    } else {
         std::string url = builtin.repo;
         std::string cmd = "git clone " + url + " " + (path / "lib" / name).string() + NULLIFY_CMD;
-        system(cmd.c_str());
-    } else {
-        if (std::filesystem::exists(path / "lib" / name)) {
-            if (!std::filesystem::exists(path / "lib" / name / "proj.bscf")) {
-                // delete the folder and redownload
+        runCommand(cmd);
+    }
+    fetch.end();
+    if (builtin.singleRepo) {
+        return true;
+    }
+    // the proj.bscf comes from the recipe store, not from a clone of the db
+    // a lib folder that lost its proj.bscf just gets it copied back in
+    if (!installRecipe(name, builtin, path / "lib" / name)) {
+        std::cerr << "Error: failed to generate lib " << name << std::endl;
+        return false;
+    }
+    return true;
+}
 
-                try {
-#ifdef _WIN32
-                    // on windows, .git doesn't have the correct permissions to delete it, so we need to allow it on the cmdline
-                    std::string cmd = "del /s /f /q " + replace((path / "lib" / name / ".git").string(), "/", "\\") + NULLIFY_CMD;
-                    system(cmd.c_str());
-#endif
-                    std::filesystem::remove_all(path / "lib" / name);
-                } catch (const std::exception& e) {
-                    std::cerr << "Error: failed to delete lib " << name << std::endl;
-                    std::cerr << e.what() << std::endl;
-                    exit(1);
-                }
-                if (depth == 0) {
-                    std::cerr << "Error: failed to generate lib " << name << std::endl;
-                    exit(1);
-                }
-                getBuiltin(name, path, depth - 1);
-            }
-            std::string cmd = "cd " + (path / "lib" / name).string() + " && git reset --hard " NULLIFY_CMD " && git pull" + NULLIFY_CMD;
-            system(cmd.c_str());
-            return true;
-        } else {
-            std::string url = builtin.repo;
-            std::string cmd = "git clone " + url + " " + (path / "lib" / name).string() + NULLIFY_CMD;
-            system(cmd.c_str());
-        }
-        // now we need to download the proj.bscf file
-        std::string url = builtin.db;
-        std::string cmd = "git clone " + url + " " + (path / "lib" / name / "bscf-db").string() + NULLIFY_CMD;
-        // first create the bscf-db folder
-        std::filesystem::create_directory(path / "lib" / name / "bscf-db");
-        system(cmd.c_str());
-        // now copy the proj.bscf file, but make sure to delete the old one first
-        if (std::filesystem::exists(path / "lib" / name / "proj.bscf")) {
-            std::filesystem::remove(path / "lib" / name / "proj.bscf");
+// fetch every recipe again, used by the updaterecipes command
+bool refreshBuiltinRecipes() {
+    bool ok = true;
+    for (const auto& [name, builtin] : BSCF_BUILTINS) {
+        if (builtin.singleRepo) continue;
+        std::cout << "Fetching recipe for " << name << std::endl;
+        if (!refreshRecipe(name, builtin.db)) {
+            ok = false;
         }
-        std::filesystem::copy(path / "lib" / name / "bscf-db" / "proj.bscf", path / "lib" / name / "proj.bscf");
-        // now delete the bscf-db folder
-        // if for some reason we can't delete it, that's fine, it's not a big deal so we need to just ignore it
-        try {
-            std::filesystem::remove_all(path / "lib" / name / "bscf-db");
-        } catch (...) {}
-
     }
-    return true;
+    return ok;
 }
 
 
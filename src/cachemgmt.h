@@ -0,0 +1,336 @@
+#pragma once
+#ifndef SRC_CACHEMGMT_H
+#define SRC_CACHEMGMT_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+
+#include "util.h"
+#include "objcache.h"
+#include "artifacts.h"
+
+// keeping the object cache in check
+// bscf . cache stats // hit/miss counts, bytes and time saved, size on disk
+// bscf . cache trim [size] // evict least recently used entries until the cache fits in size (default BSCF_CACHE_SIZE, or 5G)
+// bscf . cache verify // check every object against its recorded sha256, broken entries are removed
+// bscf . cache clear // remove everything
+// the stats of every bscf process are added into cache/stats under cache/stats.lock,
+// everything else works without a lock: entries are evicted by renaming them away first, readers just see a miss
+// whole target artifacts (artifacts.h) live in cache/targets and are trimmed/verified along with the objects
+// the cache also trims itself after a build once about a tenth of the budget has been stored since the last trim
+
+const long long BSCF_DEFAULT_CACHE_SIZE = 5LL * 1024 * 1024 * 1024;
+
+// "5G", "500M", "64K" or plain bytes, returns -1 if it doesn't parse
+long long parseSize(const std::string& s) {
+    if (s.empty()) return -1;
+    size_t idx = 0;
+    double value;
+    try {
+        value = std::stod(s, &idx);
+    } catch (...) {
+        return -1;
+    }
+    std::string unit = s.substr(idx);
+    std::transform(unit.begin(), unit.end(), unit.begin(), ::toupper);
+    if (unit == "" || unit == "B") return (long long)value;
+    if (unit == "K" || unit == "KB") return (long long)(value * 1024);
+    if (unit == "M" || unit == "MB") return (long long)(value * 1024 * 1024);
+    if (unit == "G" || unit == "GB") return (long long)(value * 1024 * 1024 * 1024);
+    return -1;
+}
+
+std::string formatSize(long long bytes) {
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(1);
+    if (bytes >= 1024LL * 1024 * 1024) ss << (double)bytes / (1024.0 * 1024 * 1024) << " GB";
+    else if (bytes >= 1024LL * 1024) ss << (double)bytes / (1024.0 * 1024) << " MB";
+    else if (bytes >= 1024) ss << (double)bytes / 1024.0 << " KB";
+    else ss << bytes << " B";
+    return ss.str();
+}
+
+long long cacheBudget() {
+    if (const char* env = std::getenv("BSCF_CACHE_SIZE")) {
+        long long size = parseSize(env);
+        if (size > 0) return size;
+        std::cerr << "Invalid BSCF_CACHE_SIZE: " << env << std::endl;
+    }
+    return BSCF_DEFAULT_CACHE_SIZE;
+}
+
+std::map<std::string, long long> readCacheStats(const std::path& p) {
+    std::map<std::string, long long> stats;
+    std::ifstream file(p);
+    std::string key;
+    long long value;
+    while (file >> key >> value) {
+        stats[key] = value;
+    }
+    return stats;
+}
+
+void writeCacheStats(const std::path& p, const std::map<std::string, long long>& stats) {
+    std::stringstream ss;
+    for (const auto& [key, value] : stats) {
+        ss << key << " " << value << std::endl;
+    }
+    writeFileAtomic(p, ss.str());
+}
+
+// one thing in the cache that gets evicted as a whole
+struct CacheEntry {
+    std::vector<std::path> files; // the first one is the one whose presence makes the entry visible
+    long long size = 0;
+    std::filesystem::file_time_type used;
+};
+
+std::vector<CacheEntry> listCacheEntries() {
+    std::vector<CacheEntry> entries;
+    std::path dir = objCacheDir();
+    std::error_code ec;
+    if (std::exists(dir / "objects")) {
+        for (const auto& file : std::recursive_directory_iterator(dir / "objects", ec)) {
+            if (!file.is_regular_file(ec) || file.path().extension() != ".o") continue;
+            CacheEntry e;
+            e.files.push_back(file.path());
+            for (const std::string ext : {".stderr", ".meta", ".bmi"}) {
+                std::path sibling = file.path();
+                sibling.replace_extension(ext);
+                e.files.push_back(sibling);
+            }
+            for (const std::path& f : e.files) {
+                if (std::exists(f, ec)) e.size += (long long)std::filesystem::file_size(f, ec);
+            }
+            e.used = std::filesystem::last_write_time(file.path(), ec);
+            entries.push_back(e);
+        }
+    }
+    if (std::exists(dir / "manifests")) {
+        for (const auto& file : std::recursive_directory_iterator(dir / "manifests", ec)) {
+            if (!file.is_regular_file(ec)) continue;
+            if (file.path().filename().string().find(".tmp") != std::string::npos) continue;
+            CacheEntry e;
+            e.files.push_back(file.path());
+            e.size = (long long)file.file_size(ec);
+            e.used = file.last_write_time(ec);
+            entries.push_back(e);
+        }
+    }
+    // whole target artifacts are a directory each (see artifacts.h)
+    if (std::exists(dir / "targets")) {
+        for (const auto& prefix : std::directory_iterator(dir / "targets", ec)) {
+            if (!prefix.is_directory(ec)) continue;
+            for (const auto& entry : std::directory_iterator(prefix.path(), ec)) {
+                if (!entry.is_directory(ec)) continue;
+                std::string name = entry.path().filename().string();
+                if (name.find(".tmp") != std::string::npos || name.find(".evict") != std::string::npos) continue;
+                CacheEntry e;
+                e.files.push_back(entry.path());
+                for (const auto& file : std::directory_iterator(entry.path(), ec)) {
+                    e.size += (long long)file.file_size(ec);
+                }
+                e.used = entry.last_write_time(ec);
+                entries.push_back(e);
+            }
+        }
+    }
+    return entries;
+}
+
+// rename first so a reader either gets the whole entry or nothing, then delete
+// on windows removing a file someone has open fails, it just stays until the next trim
+void evictCacheEntry(const CacheEntry& e) {
+    for (const std::path& f : e.files) {
+        std::error_code ec;
+        std::path gone = f;
+        gone += ".evict" + std::to_string(std::random_device{}());
+        std::filesystem::rename(f, gone, ec);
+        if (!ec) std::filesystem::remove_all(gone, ec);
+    }
+}
+
+// leftovers from processes that died halfway through writing something
+void removeStaleTempFiles() {
+    std::path dir = objCacheDir();
+    auto cutoff = std::filesystem::file_time_type::clock::now() - std::chrono::hours(1);
+    std::error_code ec;
+    for (auto it = std::recursive_directory_iterator(dir, ec); it != std::recursive_directory_iterator(); it.increment(ec)) {
+        const auto& file = *it;
+        std::string name = file.path().filename().string();
+        if (name.find(".tmp") == std::string::npos && name.find(".evict") == std::string::npos) continue;
+        if (file.last_write_time(ec) < cutoff) {
+            // half written artifacts are directories
+            if (file.is_directory(ec)) it.disable_recursion_pending();
+            std::filesystem::remove_all(file.path(), ec);
+        }
+    }
+}
+
+// returns how many bytes were freed
+long long trimCache(long long budget, bool verbose) {
+    removeStaleTempFiles();
+    std::vector<CacheEntry> entries = listCacheEntries();
+    long long total = 0;
+    for (const CacheEntry& e : entries) total += e.size;
+    std::sort(entries.begin(), entries.end(), [](const CacheEntry& a, const CacheEntry& b) {
+        return a.used < b.used;
+    });
+    long long freed = 0;
+    int evicted = 0;
+    for (const CacheEntry& e : entries) {
+        if (total - freed <= budget) break;
+        evictCacheEntry(e);
+        freed += e.size;
+        evicted++;
+    }
+    if (verbose) {
+        std::cout << "Evicted " << evicted << " entries (" << formatSize(freed) << "), cache is now "
+                  << formatSize(total - freed) << " of " << formatSize(budget) << std::endl;
+    }
+    return freed;
+}
+
+// returns the number of broken entries (which are removed)
+int verifyCache() {
+    int checked = 0;
+    int broken = 0;
+    for (const CacheEntry& e : listCacheEntries()) {
+        if (std::is_directory(e.files[0])) {
+            // an artifact, the output is the one file that isn't meta
+            checked++;
+            ArtifactMeta meta = readArtifactMeta(e.files[0] / "meta");
+            bool ok = !meta.digest.empty();
+            std::error_code ec;
+            for (const auto& file : std::directory_iterator(e.files[0], ec)) {
+                if (file.path().filename() != "meta" && sha256File(file.path()) != meta.digest) ok = false;
+            }
+            if (!ok) {
+                std::cout << "Broken: " << e.files[0].string() << std::endl;
+                evictCacheEntry(e);
+                broken++;
+            }
+            continue;
+        }
+        if (e.files[0].extension() != ".o") continue;
+        checked++;
+        std::path metaPath = e.files[0];
+        metaPath.replace_extension(".meta");
+        ObjMeta meta = readObjMeta(metaPath);
+        std::string data;
+        bool ok = !meta.digest.empty() && readStoredObject(e.files[0], data) && sha256(data) == meta.digest;
+        if (!ok) {
+            std::cout << "Broken: " << e.files[0].string() << std::endl;
+            evictCacheEntry(e);
+            broken++;
+        }
+    }
+    std::cout << "Checked " << checked << " entries, " << broken << " broken" << std::endl;
+    return broken;
+}
+
+void flushObjCacheStats();
+
+void printCacheStats() {
+    // include whatever this run did so far
+    flushObjCacheStats();
+    std::path dir = objCacheDir();
+    std::map<std::string, long long> stats;
+    {
+        FileLock lock(dir / "stats.lock");
+        stats = readCacheStats(dir / "stats");
+    }
+    long long hits = stats["direct_hits"] + stats["preprocessed_hits"];
+    long long lookups = hits + stats["misses"];
+    long long size = 0;
+    long long objects = 0;
+    long long artifacts = 0;
+    for (const CacheEntry& e : listCacheEntries()) {
+        size += e.size;
+        if (e.files[0].extension() == ".o") objects++;
+        if (std::is_directory(e.files[0])) artifacts++;
+    }
+    std::cout << "cache dir:          " << dir.string() << std::endl;
+    std::cout << "direct hits:        " << stats["direct_hits"] << std::endl;
+    std::cout << "preprocessed hits:  " << stats["preprocessed_hits"] << std::endl;
+    std::cout << "  from remote:      " << stats["remote_hits"] << std::endl;
+    std::cout << "misses:             " << stats["misses"] << std::endl;
+    std::cout << "hit rate:           " << std::fixed << std::setprecision(1)
+              << (lookups ? 100.0 * (double)hits / (double)lookups : 0.0) << "%" << std::endl;
+    std::cout << "restored targets:   " << stats["target_hits"] << std::endl;
+    std::cout << "uncached compiles:  " << stats["uncached"] << std::endl;
+    std::cout << "bytes restored:     " << formatSize(stats["bytes_restored"]) << std::endl;
+    std::cout << "time saved:         " << std::setprecision(1) << (double)stats["ms_saved"] / 1000.0 << " s" << std::endl;
+    std::cout << "objects:            " << objects << std::endl;
+    std::cout << "targets:            " << artifacts << std::endl;
+    std::cout << "size:               " << formatSize(size) << " of " << formatSize(cacheBudget()) << std::endl;
+    std::cout << "compression:        " << (objCacheCompress ? "on" : "off") << std::endl;
+    std::cout << "remote cache:       " << (remoteCacheEnabled() ? remoteCacheLocation() : "none") << std::endl;
+}
+
+// adds this process' counters to the shared stats, and trims if enough was stored since the last trim
+void flushObjCacheStats() {
+    const ObjCacheStats& s = objCacheStats;
+    if (s.directHits + s.preprocessedHits + s.misses + s.uncached + s.targetHits + s.bytesStored == 0) return;
+    std::path dir = objCacheDir();
+    bool trim = false;
+    long long budget = cacheBudget();
+    {
+        FileLock lock(dir / "stats.lock");
+        std::map<std::string, long long> stats = readCacheStats(dir / "stats");
+        stats["direct_hits"] += s.directHits;
+        stats["preprocessed_hits"] += s.preprocessedHits;
+        stats["misses"] += s.misses;
+        stats["uncached"] += s.uncached;
+        stats["bytes_restored"] += s.bytesRestored;
+        stats["ms_saved"] += s.msSaved;
+        stats["remote_hits"] += s.remoteHits;
+        stats["target_hits"] += s.targetHits;
+        stats["stored_since_trim"] += s.bytesStored;
+        if (stats["stored_since_trim"] > budget / 10) {
+            stats["stored_since_trim"] = 0;
+            trim = true;
+        }
+        writeCacheStats(dir / "stats", stats);
+    }
+    objCacheStats.reset();
+    if (trim) {
+        trimCache(budget, false);
+    }
+}
+
+// bscf . cache [stats/trim/verify/clear] ..., returns how many extra args it used
+int cacheCommand(const std::vector<std::string>& args, size_t i, int& retval) {
+    std::string sub = i + 1 < args.size() ? args[i + 1] : "stats";
+    if (sub == "stats") {
+        printCacheStats();
+        return i + 1 < args.size() ? 1 : 0;
+    } else if (sub == "trim") {
+        long long budget = cacheBudget();
+        int used = 1;
+        if (i + 2 < args.size() && parseSize(args[i + 2]) >= 0) {
+            budget = parseSize(args[i + 2]);
+            used = 2;
+        }
+        trimCache(budget, true);
+        return used;
+    } else if (sub == "verify") {
+        if (verifyCache() != 0) retval = 1;
+        return 1;
+    } else if (sub == "clear") {
+        trimCache(0, true);
+        FileLock lock(objCacheDir() / "stats.lock");
+        writeCacheStats(objCacheDir() / "stats", {});
+        return 1;
+    }
+    // not a cache subcommand, probably a target, show stats and leave it alone
+    printCacheStats();
+    return 0;
+}
+
+#endif //SRC_CACHEMGMT_H
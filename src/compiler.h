@@ -4,8 +4,12 @@
 
 #include <string>
 #include <vector>
+#include <map>
+#include <regex>
+#include <filesystem>
 
 #include "util.h"
+#include "toolchain.h"
 
 enum class CompilerType { // order of preference
     GNU,
@@ -34,16 +38,17 @@ Compiler defaultMSVCCompiler() {
     return Compiler{CompilerType::MSVC, "cl", "cl", "link", "lib"};
 }
 
+// these used to spawn the compilers, now they come from the cached probe (see toolchain.h)
 bool isGNUCompilerAvailable() {
-    return system("gcc --version" NULLIFY_CMD) == 0;
+    return toolchain().has("gcc");
 }
 
 bool isClangCompilerAvailable() {
-    return system("clang --version" NULLIFY_CMD) == 0;
+    return toolchain().has("clang");
 }
 
 bool isMSVCCompilerAvailable() {
-    return system("cl" NULLIFY_CMD) == 0;
+    return toolchain().has("cl");
 }
 
 Compiler defaultCompiler() {
@@ -59,4 +64,35 @@ Compiler defaultCompiler() {
      }
 }
 
+// changes whenever any of the tools c uses is replaced or upgraded
+std::string compilerFingerprint(const Compiler& c) {
+    return toolFingerprint({c.cc, c.cxx, c.link, c.ar});
+}
+
+// -ffile-prefix-map needs gcc 8 or clang 10, the version comes from the cached probe
+bool supportsFilePrefixMap(const Compiler& c) {
+    static std::map<std::string, bool> memo;
+    if (c.type == CompilerType::MSVC) return false;
+    auto it = memo.find(c.cc);
+    if (it != memo.end()) return it->second;
+    std::smatch m;
+    const std::string& version = toolchain().get(c.cc).version;
+    bool ok = false;
+    BSCF_STAT_ADD(Stat::REGEX, 1);
+    if (std::regex_search(version, m, std::regex("([0-9]+)\\.[0-9]+"))) {
+        int major = std::stoi(m[1].str());
+        ok = c.type == CompilerType::CLANG ? major >= 10 : major >= 8;
+    }
+    memo[c.cc] = ok;
+    return ok;
+}
+
+// compile commands only hold paths relative to the project root (main chdirs there),
+// this keeps the root itself out of __FILE__ and the debug info (DW_AT_comp_dir) too
+// so two checkouts of the same commit produce identical objects, and share cache entries
+std::string filePrefixMapFlag(const Compiler& c) {
+    if (!supportsFilePrefixMap(c)) return "";
+    return " -ffile-prefix-map=" + std::filesystem::current_path().string() + "=.";
+}
+
 #endif //SRC_COMPILER_H
@@ -0,0 +1,124 @@
+#pragma once
+#ifndef SRC_COMPRESS_H
+#define SRC_COMPRESS_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+// tiny lz77 compressor (same idea as lz4: literals + back references, no entropy coding)
+// object files compress pretty well with this and it's fast enough to not matter next to a compile
+// format:
+//     "BSZ1" + 8 byte little endian raw size
+//     then sequences of: token (high 4 bits literal count, low 4 bits match length - 4),
+//     extra literal count bytes (if 15), literals, 2 byte offset, extra match length bytes (if 15)
+//     the last sequence only has literals
+
+const char BSCF_COMPRESS_MAGIC[4] = {'B', 'S', 'Z', '1'};
+
+bool isCompressed(const std::string& data) {
+    return data.size() >= 12 && memcmp(data.data(), BSCF_COMPRESS_MAGIC, 4) == 0;
+}
+
+void compressWriteLength(std::string& out, size_t len) {
+    while (len >= 255) {
+        out += (char)255;
+        len -= 255;
+    }
+    out += (char)len;
+}
+
+std::string compressData(const std::string& in) {
+    std::string out(BSCF_COMPRESS_MAGIC, 4);
+    uint64_t size = in.size();
+    for (int i = 0; i < 8; i++) out += (char)((size >> (i * 8)) & 0xff);
+
+    const unsigned char* src = (const unsigned char*)in.data();
+    const size_t n = in.size();
+    const int hashBits = 16;
+    std::vector<int64_t> table((size_t)1 << hashBits, -1);
+    auto read32 = [src](size_t i) {
+        uint32_t v;
+        memcpy(&v, src + i, 4);
+        return v;
+    };
+    auto hash = [](uint32_t v) {
+        return (v * 2654435761u) >> (32 - hashBits);
+    };
+
+    size_t anchor = 0;
+    size_t i = 0;
+    // the last few bytes are always literals, keeps the decoder simple
+    while (n >= 12 && i + 12 <= n) {
+        uint32_t v = read32(i);
+        uint32_t h = hash(v);
+        int64_t ref = table[h];
+        table[h] = (int64_t)i;
+        if (ref < 0 || i - ref > 65535 || read32(ref) != v) {
+            i++;
+            continue;
+        }
+        size_t match = 4;
+        while (i + match + 5 <= n && src[ref + match] == src[i + match]) match++;
+
+        size_t literals = i - anchor;
+        size_t matchCode = match - 4;
+        out += (char)(((literals >= 15 ? 15 : literals) << 4) | (matchCode >= 15 ? 15 : matchCode));
+        if (literals >= 15) compressWriteLength(out, literals - 15);
+        out.append(in, anchor, literals);
+        uint16_t offset = (uint16_t)(i - ref);
+        out += (char)(offset & 0xff);
+        out += (char)(offset >> 8);
+        if (matchCode >= 15) compressWriteLength(out, matchCode - 15);
+        i += match;
+        anchor = i;
+    }
+    size_t literals = n - anchor;
+    out += (char)((literals >= 15 ? 15 : literals) << 4);
+    if (literals >= 15) compressWriteLength(out, literals - 15);
+    out.append(in, anchor, literals);
+    return out;
+}
+
+// returns false if the data is corrupt
+bool decompressData(const std::string& in, std::string& out) {
+    if (!isCompressed(in)) return false;
+    uint64_t size = 0;
+    for (int i = 0; i < 8; i++) size |= (uint64_t)(unsigned char)in[4 + i] << (i * 8);
+    out.clear();
+    out.reserve(size);
+    size_t i = 12;
+    const size_t n = in.size();
+    auto readLength = [&](size_t& len) {
+        unsigned char b;
+        do {
+            if (i >= n) return false;
+            b = (unsigned char)in[i++];
+            len += b;
+        } while (b == 255);
+        return true;
+    };
+    while (i < n) {
+        unsigned char token = (unsigned char)in[i++];
+        size_t literals = token >> 4;
+        if (literals == 15 && !readLength(literals)) return false;
+        if (i + literals > n) return false;
+        out.append(in, i, literals);
+        i += literals;
+        if (i >= n) break; // last sequence
+        if (i + 2 > n) return false;
+        size_t offset = (unsigned char)in[i] | ((size_t)(unsigned char)in[i + 1] << 8);
+        i += 2;
+        size_t match = token & 15;
+        if (match == 15 && !readLength(match)) return false;
+        match += 4;
+        if (offset == 0 || offset > out.size()) return false;
+        size_t start = out.size() - offset;
+        // byte by byte, the match can overlap what it's writing
+        for (size_t k = 0; k < match; k++) out += out[start + k];
+    }
+    return out.size() == size;
+}
+
+#endif //SRC_COMPRESS_H
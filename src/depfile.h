@@ -0,0 +1,86 @@
+#pragma once
+#ifndef SRC_DEPFILE_H
+#define SRC_DEPFILE_H
+
+#include <string>
+#include <vector>
+#include <filesystem>
+
+#include "util.h"
+
+// make style depfiles, written by -MD -MF
+//     build/obj/src_main.cpp.o: src/main.cpp src/util.h src/other\ file.h
+// (long lines are split with a backslash at the end)
+// returns every prerequisite (source first, then headers), empty if the file doesn't exist
+
+std::vector<std::string> parseDepfile(const std::string& contents) {
+    std::vector<std::string> deps;
+    std::string current;
+    bool seenColon = false;
+    for (size_t i = 0; i < contents.size(); i++) {
+        char ch = contents[i];
+        if (ch == '\\' && i + 1 < contents.size()) {
+            char next = contents[i + 1];
+            if (next == '\n' || next == '\r') {
+                // line continuation
+                i++;
+                if (next == '\r' && i + 1 < contents.size() && contents[i + 1] == '\n') i++;
+                ch = ' ';
+            } else if (next == ' ' || next == '#' || next == '\\') {
+                current += next;
+                i++;
+                continue;
+            }
+        }
+        if (ch == '$' && i + 1 < contents.size() && contents[i + 1] == '$') {
+            current += '$';
+            i++;
+            continue;
+        }
+        if (!seenColon && ch == ':' && (i + 1 >= contents.size() || contents[i + 1] == ' ' || contents[i + 1] == '\n' || contents[i + 1] == '\r')) {
+            // end of the target (the object), which we don't care about
+            seenColon = true;
+            current.clear();
+            continue;
+        }
+        if (ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r') {
+            if (seenColon && !current.empty()) deps.push_back(current);
+            current.clear();
+            if (ch == '\n') {
+                // -MP adds phony targets for every header after the first rule, stop there
+                if (seenColon && !deps.empty()) break;
+            }
+            continue;
+        }
+        current += ch;
+    }
+    if (seenColon && !current.empty()) deps.push_back(current);
+    return deps;
+}
+
+std::vector<std::string> readDepfile(const std::path& p) {
+    if (!std::exists(p)) return {};
+    return parseDepfile(readFile(p));
+}
+
+// escape a path for writing into a depfile
+std::string depfileEscape(const std::string& s) {
+    std::string out;
+    for (char ch : s) {
+        if (ch == ' ' || ch == '#' || ch == '\\') out += '\\';
+        if (ch == '$') out += '$';
+        out += ch;
+    }
+    return out;
+}
+
+bool writeDepfile(const std::path& p, const std::string& output, const std::vector<std::string>& deps) {
+    std::string contents = depfileEscape(output) + ":";
+    for (const std::string& dep : deps) {
+        contents += " \\\n " + depfileEscape(dep);
+    }
+    contents += "\n";
+    return writeFileAtomic(p, contents);
+}
+
+#endif //SRC_DEPFILE_H
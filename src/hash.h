@@ -0,0 +1,125 @@
+#pragma once
+#ifndef SRC_HASH_H
+#define SRC_HASH_H
+
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#include "util.h"
+
+// small sha256 so we don't need a crypto library
+// used anywhere we need a digest that has to be stable between runs and machines (archives, caches)
+
+class Sha256 {
+private:
+    uint32_t state[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    unsigned char block[64] = {};
+    size_t blockLen = 0;
+    uint64_t totalLen = 0;
+
+    static uint32_t rotr(uint32_t x, int n) {
+        return (x >> n) | (x << (32 - n));
+    }
+
+    void transform(const unsigned char* data) {
+        static const uint32_t k[64] = {
+                0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+                0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+                0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+                0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+                0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+                0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+                0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+                0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+        };
+        uint32_t w[64];
+        for (int i = 0; i < 16; i++) {
+            w[i] = (uint32_t)data[i * 4] << 24 | (uint32_t)data[i * 4 + 1] << 16 | (uint32_t)data[i * 4 + 2] << 8 | (uint32_t)data[i * 4 + 3];
+        }
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; i++) {
+            uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+            uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1; d = c; c = b; b = a; a = t1 + t2;
+        }
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    }
+
+public:
+    void update(const void* data, size_t len) {
+        const unsigned char* p = (const unsigned char*)data;
+        totalLen += len;
+        while (len > 0) {
+            size_t n = std::min(len, (size_t)64 - blockLen);
+            memcpy(block + blockLen, p, n);
+            blockLen += n;
+            p += n;
+            len -= n;
+            if (blockLen == 64) {
+                transform(block);
+                blockLen = 0;
+            }
+        }
+    }
+
+    void update(const std::string& s) {
+        update(s.data(), s.size());
+    }
+
+    // returns the digest as lowercase hex, the object can't be used after this
+    std::string hex() {
+        uint64_t bits = totalLen * 8;
+        unsigned char pad = 0x80;
+        update(&pad, 1);
+        unsigned char zero = 0;
+        while (blockLen != 56) {
+            update(&zero, 1);
+        }
+        unsigned char len[8];
+        for (int i = 0; i < 8; i++) {
+            len[i] = (unsigned char)(bits >> (56 - i * 8));
+        }
+        update(len, 8);
+        static const char* digits = "0123456789abcdef";
+        std::string out;
+        for (uint32_t v : state) {
+            for (int i = 28; i >= 0; i -= 4) {
+                out += digits[(v >> i) & 0xf];
+            }
+        }
+        return out;
+    }
+};
+
+std::string sha256(const std::string& data) {
+    BSCF_STAT_TIME(Stat::BYTES_HASHED);
+    BSCF_STAT_ADD(Stat::BYTES_HASHED, (long long)data.size());
+    Sha256 h;
+    h.update(data);
+    return h.hex();
+}
+
+// returns an empty string if the file can't be read
+std::string sha256File(const std::path& p) {
+    std::ifstream file(p, std::ios::binary);
+    if (!file) return "";
+    BSCF_STAT_TIME(Stat::BYTES_HASHED);
+    Sha256 h;
+    std::vector<char> buffer(1024*64);
+    while (file.read(buffer.data(), buffer.size()) || file.gcount() > 0) {
+        BSCF_STAT_ADD(Stat::BYTES_HASHED, (long long)file.gcount());
+        h.update(buffer.data(), (size_t)file.gcount());
+    }
+    return h.hex();
+}
+
+#endif //SRC_HASH_H
@@ -0,0 +1,173 @@
+#pragma once
+#ifndef SRC_JOBSERVER_H
+#define SRC_JOBSERVER_H
+
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cerrno>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#include <iostream>
+
+// the GNU make jobserver, so bscf, the makes it runs, the makes running it and gcc -flto=jobserver share one -j
+// a pipe (or, since make 4.4, a fifo) holds one byte per job that may run on top of the one every process gets for free,
+// a process reads a byte before starting another job and writes it back when that job is done
+//     client: MAKEFLAGS has --jobserver-auth=R,W (or fifo:path, or the older --jobserver-fds=R,W), bscf is being run by make
+//         (or another bscf), every action past the first needs a token from there (see Scheduler::run)
+//         if the fds are closed (make didn't mark the rule with +) it runs one action at a time, like make does
+//     server: otherwise bscf makes the pipe itself, with -j N - 1 tokens in it, and puts it in MAKEFLAGS for every
+//         child, so a PREBUILD running make -j or an lto link only uses cores bscf's own actions don't
+// the tokens are read through a non blocking fd of our own (/proc/self/fd/N opened again), the shared one stays blocking
+// for the other processes reading it
+// not on windows, where make uses a named semaphore instead
+
+class Jobserver {
+public:
+    explicit Jobserver(size_t jobs) {
+#ifndef _WIN32
+        const char* env = std::getenv("MAKEFLAGS");
+        std::string flags = env ? env : "";
+        if (env) previousFlags = env;
+        hadFlags = env != nullptr;
+        std::string auth;
+        for (const char* prefix : {"--jobserver-auth=", "--jobserver-fds="}) {
+            size_t pos = flags.rfind(prefix);
+            if (pos == std::string::npos) continue;
+            pos += strlen(prefix);
+            auth = flags.substr(pos, flags.find(' ', pos) - pos);
+            break;
+        }
+        if (!auth.empty()) {
+            joinServer(auth);
+        } else if (jobs > 1) {
+            startServer(jobs);
+        }
+#endif
+    }
+
+    ~Jobserver() {
+#ifndef _WIN32
+        while (!held.empty()) release();
+        if (ownRead >= 0) close(ownRead);
+        if (fifo && writeFd >= 0) close(writeFd);
+        if (server) {
+            close(readFd);
+            close(writeFd);
+            if (hadFlags) setenv("MAKEFLAGS", previousFlags.c_str(), 1);
+            else unsetenv("MAKEFLAGS");
+        }
+#endif
+    }
+
+    Jobserver(const Jobserver&) = delete;
+    Jobserver& operator=(const Jobserver&) = delete;
+
+    // a token for one more job, false if there's none right now (or no jobserver at all)
+    bool tryAcquire() {
+#ifndef _WIN32
+        if (ownRead < 0) return !active;
+        char c;
+        if (!nonBlocking) {
+            // somebody else may take the byte between the poll and the read, then this waits for the next one
+            pollfd p{ownRead, POLLIN, 0};
+            if (poll(&p, 1, 0) <= 0) return false;
+        }
+        if (read(ownRead, &c, 1) != 1) return false;
+        held.push_back(c);
+        return true;
+#else
+        return true;
+#endif
+    }
+
+    void release() {
+#ifndef _WIN32
+        if (held.empty()) return;
+        char c = held.back();
+        held.pop_back();
+        while (write(writeFd, &c, 1) < 0 && errno == EINTR) {}
+#endif
+    }
+
+    size_t tokens() const {
+        return held.size();
+    }
+
+    // there is a jobserver (ours or the parent's), so tryAcquire decides how many jobs run
+    bool active = false;
+
+private:
+    std::vector<char> held;
+    int readFd = -1; // the shared ends
+    int writeFd = -1;
+    int ownRead = -1; // ours to read from
+    bool nonBlocking = false;
+    bool fifo = false;
+    bool server = false;
+    std::string previousFlags;
+    bool hadFlags = false;
+
+#ifndef _WIN32
+    void openOwnRead() {
+#ifdef __linux__
+        ownRead = open(("/proc/self/fd/" + std::to_string(readFd)).c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        nonBlocking = ownRead >= 0;
+#endif
+        if (ownRead < 0) ownRead = fcntl(readFd, F_DUPFD_CLOEXEC, 0);
+    }
+
+    void joinServer(const std::string& auth) {
+        active = true;
+        if (auth.rfind("fifo:", 0) == 0) {
+            fifo = true;
+            ownRead = open(auth.substr(5).c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+            writeFd = open(auth.substr(5).c_str(), O_WRONLY | O_CLOEXEC);
+            nonBlocking = true;
+        } else {
+            size_t comma = auth.find(',');
+            if (comma != std::string::npos) {
+                readFd = std::atoi(auth.substr(0, comma).c_str());
+                writeFd = std::atoi(auth.substr(comma + 1).c_str());
+            }
+            if (readFd < 0 || writeFd < 0 || fcntl(readFd, F_GETFD) < 0 || fcntl(writeFd, F_GETFD) < 0) {
+                writeFd = -1;
+            } else {
+                openOwnRead();
+            }
+        }
+        if (ownRead < 0 || writeFd < 0) {
+            std::cerr << "warning: jobserver unavailable: using -j1. Add '+' to parent make rule." << std::endl;
+            if (ownRead >= 0) close(ownRead);
+            ownRead = -1;
+        }
+    }
+
+    void startServer(size_t jobs) {
+        int fds[2];
+        if (pipe(fds) != 0) return;
+        readFd = fds[0];
+        writeFd = fds[1];
+        std::string tokens(jobs - 1, '+');
+        if (write(writeFd, tokens.data(), tokens.size()) != (ssize_t)tokens.size()) {
+            close(readFd);
+            close(writeFd);
+            return;
+        }
+        openOwnRead();
+        server = true;
+        active = true;
+        std::string auth = std::to_string(readFd) + "," + std::to_string(writeFd);
+        std::string flags = previousFlags + " -j" + std::to_string(jobs) + " --jobserver-auth=" + auth;
+        setenv("MAKEFLAGS", flags.c_str(), 1);
+    }
+#endif
+};
+
+#endif //SRC_JOBSERVER_H
@@ -69,13 +69,33 @@ then the build dir will contain the following:
  * c, clean: clean the build dir (remove all build files)
  * sc, softclean: clean the build dir, but leave executables and libraries
  * b, build: build all targets
+ *     build --shard K/N: only this runner's part of the compiles, into the shared cache, a plain build afterwards links (see shard.h)
  * bc, buildcache: generate cahce files, but don't compile anything
  * gnu, msvc, clang: set the compiler
  * e, echo: echo commands
+ * -j N: run up to N actions at once (default: the number of cores)
+ *     fewer while the memory actions took last time wouldn't fit, or other processes keep the cores busy (see resources.h)
+ *     run from make (a jobserver in MAKEFLAGS) the make's -j is shared instead, and makes run by bscf share bscf's (see jobserver.h)
+ * --trace file: write chrome trace events (ui.perfetto.dev) of bscf's phases and every action to file, relative to the project (see trace.h)
+ * -d critpath: after a build, print the longest chain of actions and how the wall time compares to the best possible
+ * -d stats: when bscf exits, print how often its own hot paths ran and how long they took (see stats.h)
  * ne, noecho: don't echo commands (default)
+ * selfupdate: check for a new version of bscf now, and ask to install it
+ *     (otherwise bscf only checks in the background, at most once per BSCF_UPDATE_INTERVAL seconds)
+ * nocache: don't use the object cache (~/.bscf/cache) for the following builds, same as BSCF_NOCACHE=1
+ * cache [stats/trim [size]/verify/clear]: show object cache stats, evict least recently used entries down to size
+ *     (default BSCF_CACHE_SIZE or 5G), check every object against its sha256, or empty it
+ *     BSCF_CACHE_COMPRESS=1 compresses objects as they are stored
+ * prefetch [target(s)]: copy everything the remote cache (BSCF_REMOTE_CACHE) has for the targets into the local cache
+ * cacheserver [port] [dir]: run a local (127.0.0.1 only) remote cache server, for testing or a single build box
+ * worker [unix:/path or port]: compile for other bscf builds (BSCF_WORKERS=unix:/path,port,...), -j N at once (see workers.h)
+ * ur, updaterecipes: fetch the latest builtin recipes into the recipe store (~/.bscf/recipes)
+ * pchsuggest [target(s)]: list the headers that would save the most parsing as a PCH (build first so depfiles exist)
+ * affected [header]: list the sources (per target) that include the header, directly or not (see scanner.h)
+ * scanbench [target(s)]: time the built in include scanner against the compiler's -MM, and compare what they find
  * [target(s)]: build the specified target(s)
  *
- * this means that you cannot have a target named "c" or "clean" or "sc" or "softclean" or "b" or "build" or "gnu" or "msvc" or "clang" or "bc" or "buildcache" or "e" or "echo" or "ne" or "noecho"
+ * this means that you cannot have a target named "c" or "clean" or "sc" or "softclean" or "b" or "build" or "gnu" or "msvc" or "clang" or "bc" or "buildcache" or "e" or "echo" or "ne" or "noecho" or "ur" or "updaterecipes" or "selfupdate" or "nocache" or "cache" or "prefetch" or "cacheserver" or "worker" or "pchsuggest" or "affected" or "scanbench"
  * because then the build system will think that you are trying to run a command
  *
  * commands will be run in the order that they are specified
@@ -106,11 +126,24 @@ then the build dir will contain the following:
 #include <regex>
 #include <cstring>
 #include <algorithm>
+#include <functional>
 
 #include "compiler.h"
 #include "builtins.h"
 #include "util.h"
 #include "versioning.h"
+#include "archive.h"
+#include "objcache.h"
+#include "cachemgmt.h"
+#include "artifacts.h"
+#include "buildstate.h"
+#include "pch.h"
+#include "unity.h"
+#include "modules.h"
+#include "scanner.h"
+#include "scheduler.h"
+#include "shard.h"
+#include "trace.h"
 
 enum class Command {
     TARGET,
@@ -133,6 +166,12 @@ enum class Command {
     INCDIR, // add an include directory to the target, basically just adds -I[dir] to the compile command for this target and dependent targets
     BUILTIN, // include a builtin library, very similar to GITINCLUDE but it does it from my github repo and the source
     ALLOWSKIP, // allow the build system to skip this target if it is already built
+    ARCHIVE, // include a tar/zip release of a project, checked against a sha256 and cached per user (see archive.h)
+    PCH, // precompile a header for a target, EXPORT lets dependents use it too (see pch.h)
+    UNITY, // compile a target's sources in batches (see unity.h)
+    NOUNITY, // leave a source out of the target's unity batches
+    POOL, // a named limit on how many actions run at once (see scheduler.h)
+    USEPOOL, // put a target's actions (or one kind of them) in a pool
 };
 
 std::unordered_map<std::string, Command> commandMap = {
@@ -149,6 +188,12 @@ std::unordered_map<std::string, Command> commandMap = {
         {"INCDIR", Command::INCDIR},
         {"BUILTIN", Command::BUILTIN},
         {"ALLOWSKIP", Command::ALLOWSKIP},
+        {"ARCHIVE", Command::ARCHIVE},
+        {"PCH", Command::PCH},
+        {"UNITY", Command::UNITY},
+        {"NOUNITY", Command::NOUNITY},
+        {"POOL", Command::POOL},
+        {"USEPOOL", Command::USEPOOL},
 };
 
 // A FileLib is not a target type, but it is a way of specifying a dependency on a sub project that either generates a static or dynamic library.
@@ -160,6 +205,57 @@ enum class TargetType {
     INTR, // interface
 };
 
+// one step of building a target, the builder needs to know which commands are compiles so they can go through the object cache
+enum class ActionType {
+    PREBUILD,
+    COMPILE,
+    ARCHIVE,
+    LINK,
+    COPY, // copying a DLIB dependency next to the output
+    POSTBUILD,
+    PCH, // precompiling the target's PCH header, before its compiles
+};
+
+// for USEPOOL
+std::unordered_map<std::string, ActionType> actionTypeMap = {
+        {"PREBUILD", ActionType::PREBUILD},
+        {"COMPILE", ActionType::COMPILE},
+        {"ARCHIVE", ActionType::ARCHIVE},
+        {"LINK", ActionType::LINK},
+        {"COPY", ActionType::COPY},
+        {"POSTBUILD", ActionType::POSTBUILD},
+        {"PCH", ActionType::PCH},
+};
+
+std::string actionKindName(ActionType type) {
+    for (const auto& [name, t] : actionTypeMap) {
+        if (t == type) return name;
+    }
+    return "";
+}
+
+// POOL name depth, from every proj.bscf read, links go in "link" unless USEPOOL says otherwise
+std::map<std::string, size_t> bscfPools;
+
+struct Action {
+    // the leading fields, in order, the rest are set afterwards where they apply
+    Action(ActionType type, std::string cmd = "", std::string source = "", std::string output = "", std::string depfile = "",
+           std::vector<std::string> inputs = {}, std::vector<std::string> interfaceInputs = {})
+        : type(type), cmd(std::move(cmd)), source(std::move(source)), output(std::move(output)), depfile(std::move(depfile)),
+          inputs(std::move(inputs)), interfaceInputs(std::move(interfaceInputs)) {}
+
+    ActionType type;
+    std::string cmd;
+    std::string source; // COMPILE only
+    std::string output; // empty for PREBUILD/POSTBUILD
+    std::string depfile; // COMPILE/PCH only, empty if the compiler can't write one
+    std::vector<std::string> inputs; // files it reads, compiles add what's in their depfile (see buildstate.h)
+    std::vector<std::string> interfaceInputs; // shared libraries a link only needs the exported symbols of
+    std::string keyExtra; // COMPILE only, see CompileJob::extra
+    std::string bmi; // COMPILE of a module interface (or partition), the BMI it writes next to the object (see modules.h)
+    std::vector<std::string> imports; // COMPILE only, BMIs of the modules it imports
+};
+
 struct Target {
     TargetType type;
     std::string name;
@@ -172,10 +268,21 @@ struct Target {
     std::vector<std::string> libs; // libs to link
     std::vector<std::string> includes; // include dirs // meant for libs
     bool builtin = false;
-
+    std::string revision; // commit (or archive hash) of a third party library, empty for the project's own targets
+    std::string pch; // header to precompile, empty if none
+    bool pchExport = false; // dependents without a PCH of their own use this one
+    size_t unityFiles = 0; // max sources per unity batch, 0 and unityBytes 0 if not a unity build
+    long long unityBytes = 0; // max bytes of source per unity batch
+    std::vector<std::string> noUnity; // sources compiled on their own, relative to proj root
+    std::string pool; // USEPOOL target pool, for all its actions
+    std::map<ActionType, std::string> actionPools; // USEPOOL target pool KIND
+
+    std::vector<Action> actions; // filled in by bscfGenCache
 };
 
 std::string bscfRead(const std::path& p) {
+    BSCF_STAT_TIME(Stat::PROJ_READS);
+    BSCF_STAT_ADD(Stat::PROJ_READS, 1);
     std::path projPath = p / "proj.bscf";
     if (!std::exists(projPath)) {
         std::cout << "proj.bscf does not exist in " << p << std::endl;
@@ -190,6 +297,8 @@ std::string bscfRead(const std::path& p) {
     // remove all comments (lines that start with #) and all empty lines
     // also remove inline comments
 
+    BSCF_STAT_TIME(Stat::REGEX);
+    BSCF_STAT_ADD(Stat::REGEX, 4);
     contents = std::regex_replace(contents, std::regex("#.*"), "");
     contents = std::regex_replace(contents, std::regex("\n[\f\n\r\t\v]*\n"), "\n");
     contents = std::regex_replace(contents, std::regex("\n[\f\n\r\t\v]*"), "\n");
@@ -205,6 +314,7 @@ std::string bscfRead(const std::string& p) {
 
 
 std::vector<Target> bscfInclude(const std::path& path, const Compiler& c) {
+    TraceSpan span("parse", (path / "proj.bscf").string());
     std::string bscf = bscfRead(path);
     std::vector<Target> targets;
 
@@ -253,7 +363,7 @@ std::vector<Target> bscfInclude(const std::path& path, const Compiler& c) {
                             std::vector<std::path> files = recurseDir(path / source);
                             for (std::path& file : files) {
                                 std::string ext = file.extension().string();
-                                if (ext == ".c" || ext == ".cpp" || ext == ".cc" || ext == ".cxx" || ext == ".h" || ext == ".hpp" || ext == ".hh" || ext == ".hxx") {
+                                if (ext == ".c" || ext == ".cpp" || ext == ".cc" || ext == ".cxx" || ext == ".h" || ext == ".hpp" || ext == ".hh" || ext == ".hxx" || isModuleSourceExt(ext)) {
                                     if (file.string() != " " && std::exists(file)) {
                                         target.sources.push_back(file.string());
                                     }
@@ -263,7 +373,7 @@ std::vector<Target> bscfInclude(const std::path& path, const Compiler& c) {
                             std::vector<std::path> files = globDir(path / source);
                             for (std::path& file : files) {
                                 std::string ext = file.extension().string();
-                                if (ext == ".c" || ext == ".cpp" || ext == ".cc" || ext == ".cxx" || ext == ".h" || ext == ".hpp" || ext == ".hh" || ext == ".hxx") {
+                                if (ext == ".c" || ext == ".cpp" || ext == ".cc" || ext == ".cxx" || ext == ".h" || ext == ".hpp" || ext == ".hh" || ext == ".hxx" || isModuleSourceExt(ext)) {
                                     if (file.string() != " " && std::exists(file)) {
                                         target.sources.push_back(file.string());
                                     }
@@ -275,11 +385,11 @@ std::vector<Target> bscfInclude(const std::path& path, const Compiler& c) {
                     }
                     if (source == "ALL") {
                         target.includes.push_back((path / "src").string());
-                        // recurse all files in src/ that end in .c, .cpp, .cc, .cxx, .h, .hpp, .hh, .hxx
+                        // recurse all files in src/ that end in .c, .cpp, .cc, .cxx, .h, .hpp, .hh, .hxx (or a module extension, see modules.h)
                         std::vector<std::path> files = recurseDir(path / "src");
                         for (std::path& file : files) {
                             std::string ext = file.extension().string();
-                            if (ext == ".c" || ext == ".cpp" || ext == ".cc" || ext == ".cxx" || ext == ".h" || ext == ".hpp" || ext == ".hh" || ext == ".hxx") {
+                            if (ext == ".c" || ext == ".cpp" || ext == ".cc" || ext == ".cxx" || ext == ".h" || ext == ".hpp" || ext == ".hh" || ext == ".hxx" || isModuleSourceExt(ext)) {
                                 if (file.string() != " " && std::exists(file))
                                     target.sources.push_back(file.string());
                             }
@@ -322,7 +432,7 @@ std::vector<Target> bscfInclude(const std::path& path, const Compiler& c) {
             } break;
             case Command::GITINCLUDE: {
                 // if git isn't installed, then give an error
-                if (system("git --version" NULLIFY_CMD) != 0) {
+                if (!isGitAvailable()) {
                     std::cout << "Git is not installed" << std::endl;
                     exit(1);
                 }
@@ -336,6 +446,8 @@ std::vector<Target> bscfInclude(const std::path& path, const Compiler& c) {
                 std::string gitDir = (path / "lib" / name).string();
                 std::create_directories(path / "lib");
                 // if the directory already exists, git fetch it else git clone it
+                TraceSpan fetch("fetch", "git " + name);
+                fetch.arg("url", link);
                 if (std::exists(gitDir)) {
                     std::cout << std::endl << "Updating " << name << std::endl;
                     // if the file was changed locally, then the git pull won't fail, ut will say that it is up to date
@@ -346,7 +458,7 @@ std::vector<Target> bscfInclude(const std::path& path, const Compiler& c) {
                         cmd = "cd " + gitDir + " && git reset --hard " NULLIFY_CMD " && git pull origin" NULLIFY_CMD;
                     else
                         cmd = "cd " + gitDir + " && git reset --hard " NULLIFY_CMD " && git pull origin " + branch + NULLIFY_CMD;
-                    system(cmd.c_str());
+                    runCommand(cmd);
                 } else {
                     std::cout << "Cloning " << name << std::endl;
                     std::string cmd;
@@ -354,9 +466,14 @@ std::vector<Target> bscfInclude(const std::path& path, const Compiler& c) {
                         cmd = "cd " + (path / "lib").string() + " && git clone " + link + " " + name + NULLIFY_CMD;
                     else
                         cmd = "cd " + (path / "lib").string() + " && git clone -b " + branch + " " + link + " " + name + NULLIFY_CMD;
-                    system(cmd.c_str());
+                    runCommand(cmd);
                 }
+                fetch.end();
                 std::vector<Target> includedTargets = bscfInclude(gitDir, c);
+                std::string revision = gitHeadCommit(gitDir);
+                for (Target& target : includedTargets) {
+                    if (target.revision.empty()) target.revision = revision;
+                }
                 targets.insert(targets.end(), includedTargets.begin(), includedTargets.end());
 
             } break;
@@ -482,6 +599,7 @@ std::vector<Target> bscfInclude(const std::path& path, const Compiler& c) {
                 // get the rest of the line
                 std::getline(lineStream, macro);
                 // remove leading and trailing spaces
+                BSCF_STAT_ADD(Stat::REGEX, 1);
                 macro = std::regex_replace(macro, std::regex("^ +| +$"), "");
                 for (Target& target : targets) {
                     if (target.name == targetName) {
@@ -515,7 +633,7 @@ std::vector<Target> bscfInclude(const std::path& path, const Compiler& c) {
                 }
             } break;
             case Command::BUILTIN: {
-                if (system("git --version" NULLIFY_CMD) != 0) {
+                if (!isGitAvailable()) {
                     std::cout << "Git is not installed" << std::endl;
                     exit(1);
                 }
@@ -527,8 +645,10 @@ std::vector<Target> bscfInclude(const std::path& path, const Compiler& c) {
                     exit(1);
                 }
                 std::vector<Target> includedTargets = bscfInclude(path / "lib" / name, c);
+                std::string revision = gitHeadCommit(path / "lib" / name);
                 for (Target& target : includedTargets) {
                     target.builtin = true;
+                    if (target.revision.empty()) target.revision = revision;
                 }
                 targets.insert(targets.end(), includedTargets.begin(), includedTargets.end());
             } break;
@@ -542,6 +662,144 @@ std::vector<Target> bscfInclude(const std::path& path, const Compiler& c) {
                     }
                 }
             } break;
+            case Command::PCH: {
+                // usage:
+                // PCH target header [EXPORT]
+                std::string targetName;
+                std::string header;
+                std::string exportFlag;
+                lineStream >> targetName;
+                lineStream >> header;
+                lineStream >> exportFlag;
+                if (!exportFlag.empty() && exportFlag != "EXPORT") {
+                    std::cerr << "Invalid PCH option: " << exportFlag << std::endl;
+                }
+                for (Target& target : targets) {
+                    if (target.name == targetName) {
+                        target.pch = (path / header).string();
+                        target.pchExport = exportFlag == "EXPORT";
+                        break;
+                    }
+                }
+            } break;
+            case Command::UNITY: {
+                // usage:
+                // UNITY target [files per batch or size per batch]
+                std::string targetName;
+                std::string batch;
+                lineStream >> targetName;
+                lineStream >> batch;
+                size_t files = BSCF_DEFAULT_UNITY_FILES;
+                long long bytes = 0;
+                if (!batch.empty()) {
+                    if (batch.find_first_not_of("0123456789") == std::string::npos) {
+                        if (!parseCount(batch, files)) files = 0;
+                    } else {
+                        bytes = parseSize(batch);
+                        files = 0;
+                    }
+                    if (bytes < 0 || (bytes == 0 && files == 0)) {
+                        std::cerr << "Invalid UNITY batch size: " << batch << std::endl;
+                        files = BSCF_DEFAULT_UNITY_FILES;
+                        bytes = 0;
+                    }
+                }
+                for (Target& target : targets) {
+                    if (target.name == targetName) {
+                        target.unityFiles = files;
+                        target.unityBytes = bytes;
+                        break;
+                    }
+                }
+            } break;
+            case Command::NOUNITY: {
+                // usage:
+                // NOUNITY target source(s)
+                std::string targetName;
+                lineStream >> targetName;
+                std::string source;
+                while (lineStream >> source) {
+                    for (Target& target : targets) {
+                        if (target.name == targetName) {
+                            target.noUnity.push_back((path / source).string());
+                            break;
+                        }
+                    }
+                }
+            } break;
+            case Command::POOL: {
+                // usage:
+                // POOL name depth
+                std::string name;
+                std::string depth;
+                lineStream >> name;
+                lineStream >> depth;
+                size_t count = 0;
+                if (name.empty() || !parseCount(depth, count) || count == 0) {
+                    std::cerr << "Invalid POOL: " << name << " " << depth << std::endl;
+                    continue;
+                }
+                bscfPools[name] = count;
+            } break;
+            case Command::USEPOOL: {
+                // usage:
+                // USEPOOL target pool [PREBUILD/PCH/COMPILE/ARCHIVE/LINK/COPY/POSTBUILD]
+                std::string targetName;
+                std::string pool;
+                std::string kind;
+                lineStream >> targetName;
+                lineStream >> pool;
+                lineStream >> kind;
+                if (!kind.empty() && actionTypeMap.find(kind) == actionTypeMap.end()) {
+                    std::cerr << "Invalid USEPOOL action kind: " << kind << std::endl;
+                    continue;
+                }
+                for (Target& target : targets) {
+                    if (target.name == targetName) {
+                        if (kind.empty()) target.pool = pool;
+                        else target.actionPools[actionTypeMap[kind]] = pool;
+                        break;
+                    }
+                }
+            } break;
+            case Command::ARCHIVE: {
+                // usage:
+                // ARCHIVE [url or path] [name] [sha256]
+                std::string url;
+                std::string name;
+                std::string hash;
+                lineStream >> url;
+                lineStream >> name;
+                lineStream >> hash;
+                std::create_directories(path / "lib");
+                if (hash.empty()) {
+                    // no hash yet, tell the user what it should be so they can paste it in
+                    std::path tmp = archiveCacheDir() / ("unverified-" + archiveFileName(url));
+                    if (fetchArchive(url, path, tmp)) {
+                        std::cout << "Archive " << name << " has no sha256, add it to proj.bscf:" << std::endl;
+                        std::cout << "ARCHIVE " << url << " " << name << " " << sha256File(tmp) << std::endl;
+                        std::filesystem::remove(tmp);
+                    } else {
+                        std::cout << "Archive " << name << " failed" << std::endl;
+                    }
+                    exit(1);
+                }
+                std::string sha256 = normalizeSha256(hash);
+                if (sha256.empty()) {
+                    std::cout << "Archive " << name << " has an invalid sha256 (64 hex digits): " << hash << std::endl;
+                    exit(1);
+                }
+                hash = sha256;
+                if (!getArchive(url, name, hash, path)) {
+                    std::cout << "Archive " << name << " failed" << std::endl;
+                    exit(1);
+                }
+                std::vector<Target> includedTargets = bscfInclude(path / "lib" / name, c);
+                for (Target& target : includedTargets) {
+                    if (target.revision.empty()) target.revision = "sha256:" + hash;
+                }
+                targets.insert(targets.end(), includedTargets.begin(), includedTargets.end());
+            } break;
             default:
                 break;
         }
@@ -551,7 +809,9 @@ std::vector<Target> bscfInclude(const std::path& path, const Compiler& c) {
 
 }
 
-std::string bscfSourceCmd(const Target& t, const Compiler& c, const std::string& source, std::vector<std::string>& objs) {
+// moduleUnit: compile it as a module interface whatever its extension (the toolchain's std module, libstdc++'s is std.cc)
+std::string bscfSourceCmd(const Target& t, const Compiler& c, const std::string& source, std::vector<std::string>& objs, const std::string& pchFlags = "",
+                          bool moduleUnit = false) {
     // check cc or cxx
     std::string ext = std::path(source).extension().string();
     // get source relative to target path/src
@@ -560,21 +820,59 @@ std::string bscfSourceCmd(const Target& t, const Compiler& c, const std::string&
     // output should be ex/build/obj/testdir_main.c
     // first, convert to relpath
     std::string relpath = std::relative(source, t.path).string();
+    // sources from outside the target (the toolchain's std module) just use their name
+    if (relpath.rfind("..", 0) == 0) relpath = std::path(source).filename().string();
     // then replace / with _
     std::string objname = replace(relpath, "/", "_");
     objname = replace(objname, "\\","_"); // windows
     // then add .o
     objname += ".o";
-    if (ext == ".c" || ext == ".cc") {
+    // gnu and clang can write the headers each source includes into a depfile (used by the object cache)
+    // system headers too (-MD, not -MMD), an upgraded boost or libstdc++ has to miss the cache and rebuild
+    std::string depflags;
+    if (c.type != CompilerType::MSVC) {
+        depflags = " -MD -MF " + t.path.string() + "/build/obj/" + objname + ".d";
+    }
+    depflags += filePrefixMapFlag(c);
+    if (!moduleUnit && (ext == ".c" || ext == ".cc")) {
+        objs.push_back(objname);
+        return c.cc + " -c " + source + " -o " + t.path.string() + "/build/obj/" + objname + depflags;
+    } else if (!moduleUnit && (ext == ".cpp" || ext == ".cxx")) {
         objs.push_back(objname);
-        return c.cc + " -c " + source + " -o " + t.path.string() + "/build/obj/" + objname;
-    } else if (ext == ".cpp" || ext == ".cxx") {
+        // the pch is c++, c sources don't get it
+        return c.cxx + " -c " + source + " -o " + t.path.string() + "/build/obj/" + objname + depflags + pchFlags;
+    } else if (moduleUnit || isModuleSourceExt(ext)) {
         objs.push_back(objname);
-        return c.cxx + " -c " + source + " -o " + t.path.string() + "/build/obj/" + objname;
+        // gcc doesn't know the module extensions, clang wants to be told it's an interface for some of them
+        std::string lang = c.type == CompilerType::GNU ? "-x c++ " : c.type == CompilerType::CLANG ? "-x c++-module " : "-TP ";
+        return c.cxx + " -c " + lang + source + " -o " + t.path.string() + "/build/obj/" + objname + depflags + pchFlags;
     }
     return "";
 }
 
+Action bscfCompileAction(const Target& t, const Compiler& c, const std::string& source, const std::string& cmd, const std::string& objname,
+                         IncludeScanner& scanner) {
+    Action a{ActionType::COMPILE, cmd, source, t.path.string() + "/build/obj/" + objname, ""};
+    a.inputs.push_back(source);
+    if (c.type != CompilerType::MSVC) {
+        a.depfile = a.output + ".d";
+        return a;
+    }
+    // no depfile to tell us which headers it reads, the scanner finds them (see scanner.h)
+    bool computed = false;
+    std::vector<std::string> headers = scanner.closure(source, &computed);
+    if (!computed) {
+        a.inputs.insert(a.inputs.end(), headers.begin(), headers.end());
+    } else {
+        // an #include the scanner can't follow, so any header of the target counts
+        for (const std::string& header : t.sources) {
+            std::string ext = std::path(header).extension().string();
+            if (ext == ".h" || ext == ".hpp" || ext == ".hh" || ext == ".hxx") a.inputs.push_back(header);
+        }
+    }
+    return a;
+}
+
 std::vector<std::string> bscfResolveIncludes(const Target& t, const std::vector<Target>& targets) {
     std::vector<std::string> includes;
     for (const std::string& dep : t.dependencies) {
@@ -616,13 +914,118 @@ std::path bscfGetOutput(const Target& t) {
     return "";
 }
 
-std::vector<std::string> bscfGenCmd(const Target& t, const Compiler& c, const std::vector<Target>& targets) {
-    std::vector<std::string> commands;
+// defines, then include dirs (including the ones of dependencies)
+std::string bscfCompileFlags(const Target& t, const std::vector<Target>& targets) {
     std::string comp_flags = " ";
+    for (const std::string& def : t.defines) {
+        comp_flags += "-D" + def + " ";
+    }
+    for (const std::string& inc : bscfResolveIncludes(t, targets)) {
+        comp_flags += "-I" + inc + " ";
+    }
+    return comp_flags;
+}
+
+// precompiles header with the flags of owner (see pch.h)
+Action bscfPchAction(const Target& owner, const Compiler& c, const std::vector<Target>& targets, const std::string& header) {
+    std::string stub = pchStubPath(owner.path, header).string();
+    std::string out = stub + (c.type == CompilerType::CLANG ? ".pch" : ".gch");
+    std::string cmd = c.cxx + " -x c++-header " + stub + " -o " + out + " -MD -MF " + out + ".d" + filePrefixMapFlag(c) + bscfCompileFlags(owner, targets);
+    if (owner.type == TargetType::DLIB) {
+        cmd += " -fPIC";
+    }
+    return {ActionType::PCH, cmd, stub, out, out + ".d", {stub}};
+}
+
+// modules the dependencies of t provide (and their dependencies), and the dirs their BMIs are in
+void bscfDependencyModules(const Target& t, const Compiler& c, const std::vector<Target>& targets,
+                           std::map<std::string, std::string>& bmis, std::vector<std::string>& dirs) {
+    for (const std::string& dep : t.dependencies) {
+        for (const Target& target : targets) {
+            if (target.name != dep) continue;
+            bscfDependencyModules(target, c, targets, bmis, dirs);
+            std::path moduleDir = target.path / "build" / "modules";
+            for (const std::string& source : target.sources) {
+                std::string ext = std::path(source).extension().string();
+                if (ext != ".cpp" && ext != ".cxx" && !isModuleSourceExt(ext)) continue;
+                ModuleScan scan = scanModuleSourceCached(source);
+                if (scan.provides.empty()) continue;
+                bmis[scan.provides] = bmiPath(moduleDir, scan.provides, c);
+                if (std::find(dirs.begin(), dirs.end(), moduleDir.string()) == dirs.end()) dirs.push_back(moduleDir.string());
+            }
+        }
+    }
+}
+
+// the BMIs compiles write and read, and the compiles put in an order where every module is compiled before what imports it
+void bscfModuleEdges(const Target& t, std::vector<Action>& commands, const std::map<std::string, ModuleScan>& moduleScans,
+                     const std::map<std::string, std::string>& bmis, const std::string& moduleMapper) {
+    std::map<std::string, size_t> provider; // module -> index of the compile in commands
+    std::vector<size_t> compiles;
+    for (size_t i = 0; i < commands.size(); i++) {
+        Action& a = commands[i];
+        if (a.type != ActionType::COMPILE) continue;
+        compiles.push_back(i);
+        auto it = moduleScans.find(a.source);
+        if (it == moduleScans.end()) continue;
+        if (!it->second.provides.empty()) {
+            a.bmi = bmis.at(it->second.provides);
+            provider[it->second.provides] = i;
+        }
+        for (const std::string& module : it->second.imports) {
+            auto bmi = bmis.find(module);
+            if (bmi == bmis.end()) {
+                std::cerr << "Module " << module << " imported by " << a.source << " is not provided by " << t.name << " or its dependencies" << std::endl;
+                continue;
+            }
+            a.imports.push_back(bmi->second);
+            a.inputs.push_back(bmi->second);
+        }
+        if (!moduleMapper.empty()) a.inputs.push_back(moduleMapper);
+    }
+    // depth first, keeping the original order where there's no edge
+    std::vector<Action> ordered;
+    std::map<size_t, int> state; // 1 while visiting, 2 once placed
+    std::vector<size_t> stack; // being visited, for the message
+    std::function<void(size_t)> visit = [&](size_t i) {
+        if (state[i] == 2) return;
+        if (state[i] == 1) {
+            // nothing could be compiled first, the build can't work
+            std::cerr << "Error: module import cycle in " << t.name << ":";
+            for (size_t k = std::find(stack.begin(), stack.end(), i) - stack.begin(); k < stack.size(); k++) {
+                std::cerr << " " << commands[stack[k]].source << " ->";
+            }
+            std::cerr << " " << commands[i].source << std::endl;
+            exit(1);
+        }
+        state[i] = 1;
+        stack.push_back(i);
+        auto it = moduleScans.find(commands[i].source);
+        if (it != moduleScans.end()) {
+            for (const std::string& module : it->second.imports) {
+                auto p = provider.find(module);
+                if (p != provider.end()) visit(p->second);
+            }
+        }
+        state[i] = 2;
+        stack.pop_back();
+        ordered.push_back(commands[i]);
+    };
+    for (size_t i : compiles) visit(i);
+    for (size_t k = 0; k < compiles.size(); k++) {
+        commands[compiles[k]] = ordered[k];
+    }
+}
+
+std::vector<Action> bscfGenCmd(const Target& t, const Compiler& c, const std::vector<Target>& targets) {
+    std::vector<Action> commands;
+    std::string comp_flags = bscfCompileFlags(t, targets);
     std::string link_flags = " ";
+    std::vector<std::string> depOutputs; // libraries of other targets the link reads
+    std::vector<std::string> depInterfaces; // shared libraries of other targets, only their interface matters
     if (!t.prebuildcmds.empty()) {
         for (const std::string& cmd : t.prebuildcmds) {
-            commands.push_back(cmd);
+            commands.push_back({ActionType::PREBUILD, cmd});
         }
     }
     if (!t.libs.empty()) {
@@ -630,11 +1033,6 @@ std::vector<std::string> bscfGenCmd(const Target& t, const Compiler& c, const st
             link_flags += "-l" + lib + " ";
         }
     }
-    if (!t.defines.empty()) {
-        for (const std::string& def : t.defines) {
-            comp_flags += "-D" + def + " ";
-        }
-    }
     if (!t.dependencies.empty()) {
         for (const std::string& dep : t.dependencies) {
             for (const Target& target : targets) {
@@ -647,6 +1045,7 @@ std::vector<std::string> bscfGenCmd(const Target& t, const Compiler& c, const st
                         case TargetType::SLIB:
                             link_flags += "-L" + (target.path / "build" / "lib").string() + " ";
                             link_flags += "-l" + target.name + " ";
+                            depOutputs.push_back(bscfGetOutput(target).string());
                             // if the dep has a folder called include, then add that to the include flags
                             if (!target.libs.empty()) {
                                 for (const std::string& lib : target.libs) {
@@ -657,6 +1056,7 @@ std::vector<std::string> bscfGenCmd(const Target& t, const Compiler& c, const st
                         case TargetType::DLIB:
                             link_flags += "-L" + (target.path / "build" / "bin").string() + " ";
                             link_flags += "-l" + target.name + " ";
+                            depInterfaces.push_back(bscfGetOutput(target).string());
                             // add the copy command
 
                             if (!target.libs.empty()) {
@@ -665,9 +1065,9 @@ std::vector<std::string> bscfGenCmd(const Target& t, const Compiler& c, const st
                                 }
                             }
 #ifdef _WIN32
-                            commands.push_back("copy " + (target.path / "build" / "bin" / (target.name + ".dll")).string() + " " + (t.path / "build" / "bin" / (target.name + ".dll")).string());
+                            commands.push_back({ActionType::COPY, "copy " + (target.path / "build" / "bin" / (target.name + ".dll")).string() + " " + (t.path / "build" / "bin" / (target.name + ".dll")).string(), "", (t.path / "build" / "bin" / (target.name + ".dll")).string(), "", {(target.path / "build" / "bin" / (target.name + ".dll")).string()}});
 #else
-                            commands.push_back("cp " + (target.path / "build" / "bin" / ("lib" + target.name + ".so")).string() + " " + (t.path / "build" / "bin" / ("lib" + target.name + ".so")).string());
+                            commands.push_back({ActionType::COPY, "cp " + (target.path / "build" / "bin" / ("lib" + target.name + ".so")).string() + " " + (t.path / "build" / "bin" / ("lib" + target.name + ".so")).string(), "", (t.path / "build" / "bin" / ("lib" + target.name + ".so")).string(), "", {(target.path / "build" / "bin" / ("lib" + target.name + ".so")).string()}});
 #endif
                             break;
                         case TargetType::INTR:
@@ -685,56 +1085,192 @@ std::vector<std::string> bscfGenCmd(const Target& t, const Compiler& c, const st
         }
     }
 
-    std::vector<std::string> includes = bscfResolveIncludes(t, targets);
-    for (const std::string& inc : includes) {
-        comp_flags += "-I" + inc + " ";
+    // our own pch, or the one a dependency exports
+    std::string pchFlags;
+    Action pch{ActionType::PCH};
+    if (c.type != CompilerType::MSVC) {
+        const Target* owner = nullptr;
+        if (!t.pch.empty()) {
+            owner = &t;
+        } else {
+            for (const std::string& dep : t.dependencies) {
+                for (const Target& target : targets) {
+                    if (target.name == dep && target.pchExport) {
+                        owner = &target;
+                    }
+                }
+                if (owner) break;
+            }
+        }
+        if (owner) {
+            std::string header = owner->pch;
+            Action ours = bscfPchAction(t, c, targets, header);
+            if (owner != &t) {
+                Action theirs = bscfPchAction(*owner, c, targets, header);
+                bool gnu = c.type == CompilerType::GNU;
+                if (pchCompatKey(ours.cmd, ours.source, ours.output, gnu) == pchCompatKey(theirs.cmd, theirs.source, theirs.output, gnu)) {
+                    pch = theirs;
+                } else {
+                    // flags that would make the compiler reject theirs, build our own copy
+                    owner = &t;
+                }
+            }
+            if (owner == &t) {
+                writePchStub(ours.source, header);
+                commands.push_back(ours);
+                pch = ours;
+            }
+            pchFlags = " -include " + pch.source;
+            // gcc leaves what's in the pch out of the depfile unless asked
+            if (c.type == CompilerType::GNU) pchFlags += " -fpch-deps";
+        }
+    }
+
+    // c++20 modules, which sources provide and import what (see modules.h)
+    std::map<std::string, ModuleScan> moduleScans;
+    TraceSpan scanSpan("scan", "modules " + t.name);
+    for (const std::string& source : t.sources) {
+        std::string ext = std::path(source).extension().string();
+        if (ext != ".cpp" && ext != ".cxx" && !isModuleSourceExt(ext)) continue;
+        ModuleScan scan = scanModuleSourceCached(source);
+        if (!scan.provides.empty() || !scan.imports.empty()) moduleScans[source] = scan;
+    }
+    scanSpan.end();
+    std::vector<std::string> sources = t.sources;
+    std::map<std::string, std::string> bmis; // module -> BMI, ours and our dependencies'
+    std::vector<std::string> moduleDirs;
+    std::string moduleMapper;
+    std::string stdSource; // the toolchain's std module, if we build it
+    if (!moduleScans.empty()) {
+        bscfDependencyModules(t, c, targets, bmis, moduleDirs);
+        std::path moduleDir = t.path / "build" / "modules";
+        moduleDirs.insert(moduleDirs.begin(), moduleDir.string());
+        bool importsStd = false;
+        for (const auto& [source, scan] : moduleScans) {
+            if (!scan.provides.empty()) bmis[scan.provides] = bmiPath(moduleDir, scan.provides, c);
+            importsStd = importsStd || std::find(scan.imports.begin(), scan.imports.end(), "std") != scan.imports.end();
+        }
+        if (importsStd && bmis.find("std") == bmis.end()) {
+            stdSource = stdModuleSource(c);
+            if (stdSource.empty()) {
+                std::cerr << "import std in " << t.name << " needs a toolchain that ships the std module (gcc 15, clang 18 with libc++, msvc 17.5)" << std::endl;
+            } else {
+                ModuleScan scan;
+                scan.provides = "std";
+                scan.interface = true;
+                moduleScans[stdSource] = scan;
+                sources.insert(sources.begin(), stdSource);
+                bmis["std"] = bmiPath(moduleDir, "std", c);
+            }
+        }
+        std::create_directories(moduleDir);
+        if (c.type == CompilerType::GNU) {
+            moduleMapper = (moduleDir / (t.name + ".map")).string();
+            writeModuleMapper(moduleMapper, bmis);
+        }
+    }
+    auto moduleFlags = [&](const std::string& source) {
+        auto it = moduleScans.find(source);
+        if (it == moduleScans.end()) return std::string();
+        const ModuleScan& scan = it->second;
+        std::string flags;
+        std::string bmi = scan.provides.empty() ? "" : bmis[scan.provides];
+        switch (c.type) {
+            case CompilerType::GNU:
+                flags = " -fmodules-ts -fmodule-mapper=" + moduleMapper;
+                break;
+            case CompilerType::CLANG:
+                flags = " -std=c++20";
+                for (const std::string& dir : moduleDirs) flags += " -fprebuilt-module-path=" + dir;
+                if (!bmi.empty()) flags += " -fmodule-output=" + bmi;
+                if (scan.provides == "std") flags += " -Wno-reserved-module-identifier";
+                break;
+            case CompilerType::MSVC:
+                flags = " -std:c++20";
+                for (const std::string& dir : moduleDirs) flags += " -ifcSearchDir " + dir;
+                if (!bmi.empty()) flags += std::string(scan.interface ? " -interface" : " -internalPartition") + " -ifcOutput " + bmi;
+                break;
+            default:
+                break;
+        }
+        return flags;
+    };
+    // module units get the module flags but not our pch, a forced include would come before their module declaration
+    auto sourceCmd = [&](const std::string& source, std::vector<std::string>& objs) {
+        if (source == stdSource) return bscfSourceCmd(t, c, source, objs, moduleFlags(source), true);
+        auto it = moduleScans.find(source);
+        if (it != moduleScans.end() && it->second.unit) return bscfSourceCmd(t, c, source, objs, moduleFlags(source));
+        return bscfSourceCmd(t, c, source, objs, pchFlags + moduleFlags(source));
+    };
+
+    IncludeScanner scanner(bscfResolveIncludes(t, targets));
+
+    // the batches of a unity build are compiled instead of the sources in them
+    // module units can't be #included into one
+    std::vector<UnityBatch> batches;
+    if (t.unityFiles > 0 || t.unityBytes > 0) {
+        std::vector<std::string> excluded = t.noUnity;
+        for (const auto& [source, scan] : moduleScans) excluded.push_back(source);
+        batches = makeUnityBatches(t.path, sources, excluded, t.unityFiles, t.unityBytes,
+                                   [&](const std::string& source) { return scanner.closureBytes(source); });
+        for (const UnityBatch& b : batches) {
+            sources.push_back(b.file);
+        }
     }
 
     switch (t.type) {
         case TargetType::EXEC: {
             std::vector<std::string> objs;
-            for (const std::string& source : t.sources) {
-                std::string src = bscfSourceCmd(t, c, source, objs);
+            for (const std::string& source : sources) {
+                std::string src = sourceCmd(source, objs);
                 if (src.empty()) continue;
-                commands.push_back(src + comp_flags);
+                commands.push_back(bscfCompileAction(t, c, source, src + comp_flags, objs.back(), scanner));
             }
             std::string linkCmd = c.link + " ";
+            std::vector<std::string> objPaths;
             for (const std::string& obj : objs) {
                 linkCmd += t.path.string() + "/build/obj/" + obj + " ";
+                objPaths.push_back(t.path.string() + "/build/obj/" + obj);
             }
             linkCmd += "-o " + bscfGetOutput(t).string();
-            commands.push_back(linkCmd + link_flags);
+            objPaths.insert(objPaths.end(), depOutputs.begin(), depOutputs.end());
+            commands.push_back({ActionType::LINK, linkCmd + link_flags, "", bscfGetOutput(t).string(), "", objPaths, depInterfaces});
             std::create_directories(t.path / "build" / "obj");
             std::create_directories(t.path / "build" / "bin");
         } break;
         case TargetType::SLIB: {
             std::vector<std::string> objs;
-            for (const std::string& source : t.sources) {
-                std::string src = bscfSourceCmd(t, c, source, objs);
+            for (const std::string& source : sources) {
+                std::string src = sourceCmd(source, objs);
                 if (src.empty()) continue;
-                commands.push_back(src + comp_flags);
+                commands.push_back(bscfCompileAction(t, c, source, src + comp_flags, objs.back(), scanner));
             }
             std::string arCmd = c.ar + " rcs " + bscfGetOutput(t).string() + " ";
+            std::vector<std::string> objPaths;
             for (const std::string& obj : objs) {
                 arCmd += t.path.string() + "/build/obj/" + obj + " ";
+                objPaths.push_back(t.path.string() + "/build/obj/" + obj);
             }
-            commands.push_back(arCmd);
+            commands.push_back({ActionType::ARCHIVE, arCmd, "", bscfGetOutput(t).string(), "", objPaths});
             std::create_directories(t.path / "build" / "obj");
             std::create_directories(t.path / "build" / "lib");
         } break;
         case TargetType::DLIB: {
             std::vector<std::string> objs;
-            for (const std::string& source : t.sources) {
-                std::string src = bscfSourceCmd(t, c, source, objs);
+            for (const std::string& source : sources) {
+                std::string src = sourceCmd(source, objs);
                 if (src.empty()) continue;
-                commands.push_back(src + comp_flags + " -fPIC");
+                commands.push_back(bscfCompileAction(t, c, source, src + comp_flags + " -fPIC", objs.back(), scanner));
             }
             std::string linkCmd = c.link + " -shared ";
+            std::vector<std::string> objPaths;
             for (const std::string& obj : objs) {
                 linkCmd += t.path.string() + "/build/obj/" + obj + " ";
+                objPaths.push_back(t.path.string() + "/build/obj/" + obj);
             }
             linkCmd += "-o " + bscfGetOutput(t).string();
-            commands.push_back(linkCmd + link_flags);
+            objPaths.insert(objPaths.end(), depOutputs.begin(), depOutputs.end());
+            commands.push_back({ActionType::LINK, linkCmd + link_flags, "", bscfGetOutput(t).string(), "", objPaths, depInterfaces});
             std::create_directories(t.path / "build" / "obj");
             std::create_directories(t.path / "build" / "bin");
         } break;
@@ -746,77 +1282,47 @@ std::vector<std::string> bscfGenCmd(const Target& t, const Compiler& c, const st
             std::cout << "Target name: " << t.name << std::endl;
             break;
     }
+    if (!moduleScans.empty()) {
+        bscfModuleEdges(t, commands, moduleScans, bmis, moduleMapper);
+    }
+    // the depfile of a batch lists the sources in it, msvc has none so they're added here
+    for (Action& a : commands) {
+        for (const UnityBatch& b : batches) {
+            if (a.type == ActionType::COMPILE && a.source == b.file) {
+                a.inputs.insert(a.inputs.end(), b.sources.begin(), b.sources.end());
+            }
+        }
+    }
+    if (!pch.cmd.empty()) {
+        // the flags the pch was built with leak into every compile using it
+        for (Action& a : commands) {
+            if (a.type == ActionType::COMPILE && a.cmd.find(pchFlags) != std::string::npos) {
+                a.keyExtra = pch.cmd;
+                a.inputs.push_back(pch.output);
+            }
+        }
+    }
     if (!t.postbuildcmds.empty()) {
         for (const std::string& cmd : t.postbuildcmds) {
-            commands.push_back(cmd);
+            commands.push_back({ActionType::POSTBUILD, cmd});
         }
     }
     return commands;
 }
 
-std::string getFileHash(const std::path& p) {
-//    std::ifstream file(p, std::ios::binary);
-//    std::stringstream ss;
-//    ss << file.rdbuf();
-//    std::string contents = ss.str();
-//    return std::to_string(std::hash<std::string>{}(contents));
-    // collisions are possible, since we are hashing a file of arbitrary length to a string of pretty small length
-    // we will split the file into chunks
-    std::string final;
-
-    std::ifstream file(p, std::ios::binary);
-    std::vector<char> buffer(1024*8);
-    while (file.read(buffer.data(), buffer.size())) {
-        final += std::to_string(std::hash<std::string>{}(std::string(buffer.data(), buffer.size())));
-        final += "x";
-    }
-    final += std::to_string(std::hash<std::string>{}(std::string(buffer.data(), file.gcount())));
-    return final;
-
-
-
-}
-
-std::string getFileNameHash(const std::path& p) {
-    return std::to_string(std::hash<std::string>{}(p.string()));
-}
-
 std::vector<Target> bscfGenCache(const std::path& dir, const Compiler& c) {
     std::vector<Target> targets = bscfInclude(dir, c);
     for (Target& t : targets) {
+        TraceSpan span("gen", t.name);
         std::create_directories(t.path / "build" / "cache");
-        std::vector<std::string> commands = bscfGenCmd(t, c, targets);
+        t.actions = bscfGenCmd(t, c, targets);
+        // the builder runs t.actions, the .target file is just so you can see what it will run
         std::path out = t.path / "build" / "cache" / (t.name + ".target");
         std::ofstream file(out);
-        for (std::string& cmd : commands) {
-            file << cmd << std::endl;
+        for (const Action& a : t.actions) {
+            file << a.cmd << std::endl;
         }
         file.close();
-
-        // build/cache/targetname.sources
-        // contains a list of key value pairs
-        // key is hash of source file name
-        // value is source file hash/checksum
-        std::path sourceFile = t.path / "build" / "cache" / (t.name + ".sources");
-        if (std::exists(sourceFile)) {
-            // copy it to target.prev.sources
-            std::filesystem::path prev = (t.path / "build" / "cache" / (t.name + ".prev.sources"));
-            if (std::exists(prev)) {
-                std::filesystem::remove(prev);
-            }
-            std::filesystem::copy(sourceFile, prev, std::filesystem::copy_options::overwrite_existing);
-        }
-        std::ofstream sourceFileStream(sourceFile);
-        for (const std::string& source : t.sources) {
-            std::string nameHash = getFileNameHash(t.path / source);
-            std::string sourceHash = getFileHash(t.path / source);
-            sourceFileStream << nameHash << " " << sourceHash << std::endl;
-        }
-        // add proj.bscf to the sources file
-        std::string projHash = getFileHash(t.path / "proj.bscf");
-        sourceFileStream << getFileNameHash(t.path / "proj.bscf") << " " << projHash << std::endl;
-        sourceFileStream.close();
-
     }
     return targets;
 }
@@ -824,141 +1330,644 @@ std::vector<Target> bscfGenCache(const std::path& dir, const Compiler& c) {
 class bscfBuilder {
 private:
     std::vector<Target> targets;
-    std::vector<Target> built;
-    std::vector<Target> failed;
-    // we need to keep track of the targets that have been built, so we don't build them again
-    // but we can't just loop through the targets, because we need to build the dependencies first
-    // so we need to keep track of the targets that have been built, and then loop through the targets, and if the target has been built, skip it
-    // and if the target has not been built, build it, and add it to the built list
-
-    bool buildTargetCMD(const Target& t) {
-        // check sources file
-        if (!force) {
-            std::path sourceFile = t.path / "build" / "cache" / (t.name + ".sources");
-            std::path prevSourceFile = t.path / "build" / "cache" / (t.name + ".prev.sources");
-            bool skip = true;
-            if (std::exists(sourceFile) && std::exists(prevSourceFile)) {
-                // compare the two files
-                std::ifstream sourceFileStream(sourceFile);
-                std::ifstream prevSourceFileStream(prevSourceFile);
-                std::string sourceLine;
-                std::string prevSourceLine;
-                while (std::getline(sourceFileStream, sourceLine) && std::getline(prevSourceFileStream, prevSourceLine)) {
-                    if (sourceLine != prevSourceLine) {
-                        // source file has changed
-                        // need to rebuild
-                        skip = false;
-                        break;
-                    }
+    std::string fingerprint; // of the compiler the actions were generated for
+    CompilerType compilerType;
+    // every action of every target is a job for the scheduler (see scheduler.h), plus three milestones per target:
+    //     start: the target is checked (already built? restored from the artifact cache?) and its build state read
+    //     headers: its prebuild steps ran, so whatever headers they generate exist
+    //     done: everything of it ran, the build state is written
+    // compiles only need the headers of the dependencies, so a chain of libraries compiles all at once and only the
+    // archive/link steps wait for each other: links (and copies of DLIBs) wait for the dependencies to be done
+    // targets with prebuild steps (which may run a tool another target builds) and third party libraries
+    // (restored as a whole from the artifact cache) start once their dependencies are done
+    // edges from the actions themselves: a compile waits for the pch it uses and the modules it imports
+    // each action's cost is how long it took last time (ms in the build state), or a guess from its size if it never ran,
+    // and the scheduler starts whatever has the longest chain behind it first, so the link of a deep dependency chain isn't
+    // left waiting on one big compile that happened to start last
+    // the peak memory an action took last time is what the scheduler expects it to need, so it only starts
+    // as many big compiles as the memory (or cgroup limit) there is allows, and fills the other slots with small ones
+
+    // what the jobs of a target share while it's being built
+    struct TargetRun {
+        std::mutex mutex;
+        std::path statePath;
+        std::map<std::string, ActionState> next; // the build state as it will be written (see buildstate.h)
+        std::string key; // in the artifact cache, empty if none
+        bool skipped = false; // nothing to do: already built, or restored as a whole
+        bool dirty = false; // something other than prebuild/postbuild steps has to run
+        bool ran = false;
+        bool changed = false; // something ran and didn't just reproduce its previous output
+        bool failed = false;
+        bool finished = false; // its done job ran
+        std::chrono::steady_clock::time_point start;
+    };
+
+    // key of the target in the artifact cache (see artifacts.h), empty if it can't be cached
+    // only libraries with a known revision whose dependencies can be cached too
+    std::string artifactKey(const Target& t) {
+        if (t.revision.empty() || (t.type != TargetType::SLIB && t.type != TargetType::DLIB)) return "";
+        // the artifact is only the library, dependents importing its modules need the BMIs too
+        for (const Action& a : t.actions) {
+            if (!a.bmi.empty()) return "";
+        }
+        std::stringstream ss;
+        ss << BSCF_ARTIFACT_VERSION << std::endl;
+        ss << t.name << " " << (int)t.type << " " << t.revision << std::endl;
+        ss << fingerprint << std::endl;
+        // builtin recipes aren't part of the library's commit
+        ss << sha256File(t.path / "proj.bscf") << std::endl;
+        // the effective flags, without where the library happens to be checked out
+        for (const Action& a : t.actions) {
+            ss << (int)a.type << " " << replace(normalizePrefixMap(a.cmd), t.path.string(), "<lib>") << std::endl;
+        }
+        for (const std::string& dep : t.dependencies) {
+            for (const Target& target : targets) {
+                if (target.name == dep) {
+                    std::string depKey = artifactKey(target);
+                    if (depKey.empty()) return "";
+                    ss << dep << " " << depKey << std::endl;
+                    break;
                 }
-            } else {
-                skip = false;
-            }
-            if (skip) {
-                // target has not changed, so we can skip it
-                std::cout << "# Skipping " << t.name << " as it has not changed" << std::endl;
-                return true;
             }
         }
+        return sha256(ss.str());
+    }
 
-        std::cout << "# Building " << t.name << std::endl;
-        // just run commands in the t.path/build/cache/t.name.cache file
-        std::ifstream file(t.path / "build" / "cache" / (t.name + ".target"));
-        std::string cmd;
-        while (std::getline(file, cmd)) {
-            if (echo)
-                std::cout << cmd << std::endl;
-            int s = system(cmd.c_str());
-            if (s != 0) {
+    // build/cache/name.artifact holds the key of what's in the output right now
+    std::path artifactStamp(const Target& t) {
+        return t.path / "build" / "cache" / (t.name + ".artifact");
+    }
+
+    // the steps that aren't covered by the artifact itself
+    // never write through a hard link into the artifact cache (see artifacts.h)
+    void unshareOutputs(const Target& t, const Action& a) {
+        if (a.type == ActionType::ARCHIVE || a.type == ActionType::LINK) breakHardLink(a.output);
+        // a copy of a restored (read only) output can't be copied over
+        if (a.type == ActionType::COPY) {
+            std::error_code ec;
+            std::filesystem::remove(a.output, ec);
+        }
+        if (a.type == ActionType::PREBUILD || a.type == ActionType::POSTBUILD) unshareHardLink(bscfGetOutput(t));
+    }
+
+    bool runNonCompileActions(const Target& t) {
+        for (const Action& a : t.actions) {
+            if (a.type == ActionType::COMPILE || a.type == ActionType::ARCHIVE || a.type == ActionType::LINK) continue;
+            // dependents may be using an exported pch
+            if (a.type == ActionType::PCH && !t.pchExport) continue;
+            if (echo) {
+                std::lock_guard<std::mutex> lock(bscfOutputMutex);
+                std::cout << a.cmd << std::endl;
+            }
+            unshareOutputs(t, a);
+            if (runCommand(a.cmd) != 0) {
+                std::lock_guard<std::mutex> lock(bscfOutputMutex);
                 std::cerr << "Failed to build " << t.name << std::endl;
                 return false;
             }
         }
-        file.close();
-        built.push_back(t);
+        invalidateFileDigests();
         return true;
     }
 
-    bool buildTarget(const Target& t, bool force=false) {
-        // first, check if the target has already been built
-        if (!force && t.builtin) {
-            // if target's output file exists, then it has already been built
-            std::path outputFile = bscfGetOutput(t);
-            if (std::exists(outputFile)) {
-                // target has already been built
-                return true;
+    // see buildstate.h
+    std::string actionKey(const Action& a) {
+        if (a.type == ActionType::PREBUILD) return "prebuild:" + sha256(a.cmd);
+        if (a.type == ActionType::POSTBUILD) return "postbuild:" + sha256(a.cmd);
+        return a.output;
+    }
+
+    std::string actionCmdHash(const Action& a) {
+        return sha256(fingerprint + "\n" + a.cmd);
+    }
+
+    // before the action runs, so an input that changes while it runs is seen as changed next time (as in ninja)
+    // the depfile is still the one of the last run, its deps are mostly the ones it'll write again
+    std::vector<InputStamp> actionInputsBefore(const Action& a) {
+        std::vector<InputStamp> inputs;
+        for (const std::string& in : a.inputs) {
+            inputs.push_back(stampInput(in));
+        }
+        for (const std::string& in : a.interfaceInputs) {
+            inputs.push_back(stampInput(in, true));
+        }
+        if (!a.depfile.empty()) {
+            for (const std::string& dep : readDepfile(a.depfile)) {
+                if (dep != a.source) inputs.push_back(stampInput(dep));
             }
         }
-        for (const Target& b : built) {
-            if (b.name == t.name) {
-                // target has already been built
-                return true;
+        return inputs;
+    }
+
+    // after the action ran: the stamps from before, for the deps of the depfile it just wrote
+    // a dep that's new in it is stamped now, unless it changed after the action started, then it's left stale
+    std::vector<InputStamp> actionInputs(const Action& a, const std::vector<InputStamp>& before, std::filesystem::file_time_type started) {
+        size_t own = a.inputs.size() + a.interfaceInputs.size();
+        std::vector<InputStamp> inputs(before.begin(), before.begin() + own);
+        if (a.depfile.empty()) return inputs;
+        std::map<std::string, const InputStamp*> old;
+        for (size_t i = own; i < before.size(); i++) {
+            old[before[i].path] = &before[i];
+        }
+        for (const std::string& dep : readDepfile(a.depfile)) {
+            if (dep == a.source) continue;
+            auto it = old.find(dep);
+            if (it != old.end()) {
+                inputs.push_back(*it->second);
+                continue;
+            }
+            InputStamp s = stampInput(dep);
+            if (s.mtime > (long long)started.time_since_epoch().count()) {
+                // never matches a file that's there, so the action runs again
+                s = InputStamp();
+                s.path = dep;
             }
+            inputs.push_back(s);
         }
-        for (const Target& f : failed) {
-            if (f.name == t.name) {
-                // target has failed before
-                return false;
+        return inputs;
+    }
+
+    int findTarget(const std::string& name) {
+        for (size_t i = 0; i < targets.size(); i++) {
+            if (targets[i].name == name) return (int)i;
+        }
+        return -1;
+    }
+
+    // indices of everything t depends on, directly or not
+    void collectDependencies(size_t t, std::vector<bool>& seen, std::vector<size_t>& out) {
+        for (const std::string& dep : targets[t].dependencies) {
+            int d = findTarget(dep);
+            if (d < 0 || seen[d]) continue;
+            seen[d] = true;
+            out.push_back((size_t)d);
+            collectDependencies((size_t)d, seen, out);
+        }
+    }
+
+    std::vector<size_t> allDependencies(size_t t) {
+        std::vector<bool> seen(targets.size(), false);
+        seen[t] = true;
+        std::vector<size_t> out;
+        collectDependencies(t, seen, out);
+        return out;
+    }
+
+    // a guess for an action that never ran, in ms: compiles by the size of the source and the project headers it includes
+    // only has to be about right next to the others and the recorded times, it's replaced by the real time after the first build
+    long long estimateActionMs(const Action& a, std::unique_ptr<IncludeScanner>& scanner, const Target& t) {
+        switch (a.type) {
+            case ActionType::PCH:
+            case ActionType::COMPILE: {
+                if (!scanner) scanner = std::make_unique<IncludeScanner>(bscfResolveIncludes(t, targets));
+                return BSCF_COMPILE_MS + scanner->closureBytes(a.source) / 1024 * BSCF_COMPILE_MS_PER_KB;
             }
+            case ActionType::LINK:
+                return BSCF_LINK_MS;
+            case ActionType::ARCHIVE:
+                return BSCF_ARCHIVE_MS;
+            case ActionType::COPY:
+                return BSCF_COPY_MS;
+            default:
+                return BSCF_STEP_MS;
         }
-        // target has not been built
-        // first, build dependencies
-        for (const std::string& dep : t.dependencies) {
-            for (const Target& target : targets) {
-                if (target.name == dep) {
-                    bool ok = buildTarget(target);
-                    if (!ok) {
-                        failed.push_back(target);
-                        failed.push_back(t);
-                        return false;
-                    }
-                    break;
-                }
+    }
+
+    // "" if it's in no pool
+    std::string actionPool(const Target& t, const Action& a) {
+        auto it = t.actionPools.find(a.type);
+        if (it != t.actionPools.end()) return it->second;
+        if (!t.pool.empty()) return t.pool;
+        if (a.type == ActionType::LINK) return "link";
+        return "";
+    }
+
+    // a worker can compile it (see workers.h)
+    bool distributable(const Action& a) {
+        return a.type == ActionType::COMPILE && compilerType != CompilerType::MSVC && a.bmi.empty() && a.imports.empty() && !a.depfile.empty();
+    }
+
+    std::string actionLabel(const Target& t, const Action& a) {
+        switch (a.type) {
+            case ActionType::PCH:
+            case ActionType::COMPILE:
+                return t.name + ": " + a.source;
+            case ActionType::PREBUILD:
+                return t.name + ": prebuild " + a.cmd.substr(0, 40);
+            case ActionType::POSTBUILD:
+                return t.name + ": postbuild " + a.cmd.substr(0, 40);
+            default:
+                return t.name + ": " + std::path(a.output).filename().string();
+        }
+    }
+
+    bool startTarget(const Target& t, TargetRun& run, bool forceThis) {
+        // a builtin library that's already built
+        // unless it came from another revision of the library (or other flags)
+        std::string key = artifactKey(t);
+        if (!forceThis && t.builtin && std::exists(bscfGetOutput(t)) && (key.empty() || readFile(artifactStamp(t)) == key)) {
+            run.skipped = true;
+            return true;
+        }
+        // a library whose output is still the artifact for its key is done, whatever its objects look like
+        if (!force && !key.empty() && std::exists(bscfGetOutput(t)) && readFile(artifactStamp(t)) == key) {
+            std::lock_guard<std::mutex> lock(bscfOutputMutex);
+            std::cout << "# Skipping " << t.name << " as it has not changed" << std::endl;
+            run.skipped = true;
+            return true;
+        }
+        if (!objCacheEnabled) key.clear();
+        if (!key.empty() && !force && restoreArtifact(key, bscfGetOutput(t))) {
+            {
+                std::lock_guard<std::mutex> lock(bscfOutputMutex);
+                std::cout << "# Restored " << t.name << " from the artifact cache" << std::endl;
+            }
+            if (!runNonCompileActions(t)) return false;
+            writeFileAtomic(artifactStamp(t), key);
+            run.skipped = true;
+            return true;
+        }
+
+        // only the actions whose command or inputs changed run
+        run.key = key;
+        run.statePath = t.path / "build" / "cache" / (t.name + ".state");
+        std::map<std::string, ActionState> prev;
+        if (!force) prev = readBuildState(run.statePath);
+        for (const Action& a : t.actions) {
+            auto it = prev.find(actionKey(a));
+            if (it != prev.end()) run.next[it->first] = it->second;
+        }
+        // prebuild steps run whenever something else in the target has to (or when they're new),
+        // postbuild steps whenever something before them changed its output (or when they're new)
+        // (a target with prebuild steps starts after its dependencies are done, so this sees their final outputs)
+        bool hasPrebuild = false;
+        for (const Action& a : t.actions) {
+            if (a.type == ActionType::PREBUILD) hasPrebuild = true;
+        }
+        for (const Action& a : t.actions) {
+            if (!hasPrebuild) break;
+            if (a.type == ActionType::PREBUILD || a.type == ActionType::POSTBUILD) continue;
+            auto it = run.next.find(actionKey(a));
+            if ((!a.bmi.empty() && !std::exists(a.bmi)) || !actionUpToDate(it == run.next.end() ? nullptr : &it->second, actionCmdHash(a), a.output)) {
+                run.dirty = true;
+                break;
+            }
+        }
+        run.start = std::chrono::steady_clock::now();
+        return true;
+    }
+
+    // one action of bscfGenCache, compiles go through the object cache (see objcache.h)
+    bool runAction(const Target& t, TargetRun& run, const Action& a) {
+        if (run.skipped) return true;
+        std::string key = actionKey(a);
+        // checked on a copy, so the other jobs of the target aren't held up while this hashes its inputs
+        ActionState prev;
+        bool havePrev = false;
+        bool dirty;
+        bool changed;
+        {
+            std::lock_guard<std::mutex> lock(run.mutex);
+            auto it = run.next.find(key);
+            if (it != run.next.end()) {
+                prev = it->second;
+                havePrev = true;
             }
+            dirty = run.dirty;
+            changed = run.changed;
+        }
+        TraceSpan check("hash", traceEnabled ? "check " + actionLabel(t, a) : "");
+        bool upToDate = (a.bmi.empty() || std::exists(a.bmi)) && actionUpToDate(havePrev ? &prev : nullptr, actionCmdHash(a), a.output);
+        check.end();
+        bool doRun;
+        if (a.type == ActionType::PREBUILD) doRun = dirty || !upToDate;
+        else if (a.type == ActionType::POSTBUILD) doRun = changed || !upToDate;
+        else doRun = !upToDate;
+        if (!doRun) {
+            // with the new mtimes of inputs that were only touched
+            std::lock_guard<std::mutex> lock(run.mutex);
+            run.next[key] = prev;
+            return true;
         }
-        // now build the target
-        bool good = buildTargetCMD(t);
-        if (!good) {
-            failed.push_back(t);
+        {
+            std::lock_guard<std::mutex> lock(run.mutex);
+            std::lock_guard<std::mutex> out(bscfOutputMutex);
+            if (!run.ran) {
+                std::cout << "# Building " << t.name << std::endl;
+                run.ran = true;
+            }
+            if (echo)
+                std::cout << a.cmd << std::endl;
+        }
+        auto stampedAt = std::filesystem::file_time_type::clock::now();
+        std::vector<InputStamp> inputs = actionInputsBefore(a);
+        auto started = std::chrono::steady_clock::now();
+        TraceSpan span("action", traceEnabled ? actionLabel(t, a) : "");
+        span.arg("target", t.name);
+        span.arg("kind", actionKindName(a.type));
+        long long rss = -1;
+        bool ok;
+        if (a.type == ActionType::COMPILE) {
+            // what's in the imported modules isn't in the command or the depfile
+            std::string extra = a.keyExtra;
+            for (const std::string& bmi : a.imports) {
+                extra += "\nimport " + std::path(bmi).filename().string() + " " + fileDigest(bmi);
+            }
+            ok = cachedCompile({a.cmd, a.source, a.output, a.depfile, fingerprint, extra, a.bmi, distributable(a)}, &rss);
+            span.arg("exit", ok ? 0 : 1);
+        } else {
+            unshareOutputs(t, a);
+            int status;
+            {
+                // with workers, the -j slots here are shared with compiles they didn't take
+                LocalSlot slot;
+                status = runCommand(a.cmd, &rss);
+            }
+            ok = status == 0;
+            span.arg("exit", exitCode(status));
+            // prebuild steps and the like can write headers
+            invalidateFileDigests();
+        }
+        span.arg("rss", rss);
+        span.end();
+        if (!a.output.empty()) forgetFileDigest(a.output);
+        if (!a.bmi.empty()) forgetFileDigest(a.bmi);
+        if (!ok) {
+            std::lock_guard<std::mutex> lock(run.mutex);
+            run.next.erase(key);
+            if (!run.failed) {
+                std::lock_guard<std::mutex> out(bscfOutputMutex);
+                std::cerr << "Failed to build " << t.name << std::endl;
+                run.failed = true;
+            }
             return false;
         }
+        ActionState state{actionCmdHash(a), "-", actionInputs(a, inputs, stampedAt)};
+        state.ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started).count();
+        // a cache hit says nothing about how much memory the compiler needs
+        state.rss = rss >= 0 ? rss : prev.rss;
+        if (!a.output.empty() && std::exists(a.output)) state.outDigest = fileDigest(a.output);
+        std::lock_guard<std::mutex> lock(run.mutex);
+        auto old = run.next.find(key);
+        if (a.output.empty() || old == run.next.end() || old->second.outDigest != state.outDigest) run.changed = true;
+        run.next[key] = state;
         return true;
     }
 
-public:
-    explicit bscfBuilder(const std::vector<Target>& targets) {
-        this->targets = targets;
+    bool finishTarget(const Target& t, TargetRun& run) {
+        if (run.skipped) return true;
+        std::lock_guard<std::mutex> lock(run.mutex);
+        run.finished = true;
+        writeBuildState(run.statePath, run.next);
+        // the output wasn't made here, the merge does that
+        if (shards > 0) return true;
+        if (!run.ran) {
+            std::lock_guard<std::mutex> out(bscfOutputMutex);
+            std::cout << "# Skipping " << t.name << " as it has not changed" << std::endl;
+        } else if (!run.key.empty()) {
+            long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - run.start).count();
+            std::vector<std::string> includes;
+            for (const std::string& inc : t.includes) {
+                includes.push_back(std::relative(inc, t.path).string());
+            }
+            storeArtifact(run.key, bscfGetOutput(t), includes, ms);
+        }
+        if (!run.key.empty()) writeFileAtomic(artifactStamp(t), run.key);
+        return true;
     }
 
-    bool build() {
-        for (const Target& t : targets) {
-            buildTarget(t);
+    // with --shard, which actions this shard leaves to the others (see shard.h)
+    // the split goes by the estimates only, the ms in the build state are this runner's and the others may have none
+    std::vector<std::vector<bool>> shardSkips(const std::vector<bool>& wanted) {
+        std::vector<std::vector<bool>> skip(targets.size());
+        for (size_t i = 0; i < targets.size(); i++) skip[i].assign(targets[i].actions.size(), false);
+        if (shards == 0) return skip;
+        std::vector<std::pair<long long, std::string>> units;
+        std::vector<std::pair<size_t, size_t>> where;
+        std::map<std::string, std::pair<size_t, size_t>> producer; // pch and BMI outputs -> the action writing them
+        for (size_t i = 0; i < targets.size(); i++) {
+            if (!wanted[i]) continue;
+            std::unique_ptr<IncludeScanner> scanner;
+            for (size_t k = 0; k < targets[i].actions.size(); k++) {
+                const Action& a = targets[i].actions[k];
+                if (!a.bmi.empty()) producer[a.bmi] = {i, k};
+                if (a.type == ActionType::PCH) producer[a.output] = {i, k};
+                if (a.type == ActionType::COMPILE) {
+                    units.emplace_back(estimateActionMs(a, scanner, targets[i]), a.output);
+                    where.emplace_back(i, k);
+                }
+                // everything else waits for the merge, prebuild steps run everywhere (they may write headers)
+                skip[i][k] = a.type != ActionType::PREBUILD;
+            }
         }
-        if (!failed.empty()) {
-            return false;
+        std::vector<size_t> shardOf = planShards(units, shards);
+        std::vector<std::pair<size_t, size_t>> todo;
+        long long mine = 0;
+        long long total = 0;
+        size_t count = 0;
+        for (size_t u = 0; u < units.size(); u++) {
+            total += units[u].first;
+            if (shardOf[u] != shard - 1) continue;
+            todo.push_back(where[u]);
+            mine += units[u].first;
+            count++;
         }
-        return true;
+        // and the pch and module interfaces those compiles need
+        while (!todo.empty()) {
+            auto [i, k] = todo.back();
+            todo.pop_back();
+            skip[i][k] = false;
+            const Action& a = targets[i].actions[k];
+            std::vector<std::string> needs = a.inputs;
+            needs.insert(needs.end(), a.imports.begin(), a.imports.end());
+            for (const std::string& in : needs) {
+                auto it = producer.find(in);
+                if (it != producer.end() && skip[it->second.first][it->second.second]) todo.push_back(it->second);
+            }
+        }
+        std::cout << "# Shard " << shard << "/" << shards << ": " << count << " of " << units.size() << " compiles, about "
+                  << mine << " ms of " << total << " ms" << std::endl;
+        return skip;
     }
 
-    bool buildTarget(const std::string& target) {
-        for (const Target& t : targets) {
-            if (t.name == target) {
-                buildTarget(t, true);
-                for (const Target& f : failed) {
-                    if (f.name == t.name) {
+    // builds roots and everything they depend on
+    // forceRoots builds the roots even if they're builtin libraries that look built already
+    bool buildTargets(const std::vector<size_t>& roots, bool forceRoots) {
+        std::vector<bool> wanted(targets.size(), false);
+        std::vector<bool> isRoot(targets.size(), false);
+        for (size_t r : roots) {
+            wanted[r] = true;
+            isRoot[r] = true;
+            for (size_t d : allDependencies(r)) wanted[d] = true;
+        }
+        Scheduler scheduler;
+        std::vector<std::unique_ptr<TargetRun>> runs(targets.size());
+        std::vector<size_t> startJob(targets.size());
+        std::vector<size_t> headersJob(targets.size());
+        std::vector<size_t> doneJob(targets.size());
+        std::vector<std::vector<size_t>> actionJobs(targets.size());
+        std::map<std::string, size_t> producer; // pch and BMI outputs -> the job writing them
+        std::map<std::string, size_t> pools; // name -> the scheduler's pool
+        for (const auto& [name, depth] : bscfPools) {
+            pools[name] = scheduler.addPool(depth);
+        }
+        // with workers (see workers.h) there are more slots than -j, but only -j of them for what runs here
+        size_t workerSlots = workerPool().slots();
+        size_t localPool = scheduler.addPool(jobs);
+        workerPool().setLocalSlots(workerSlots > 0 ? jobs : 0);
+        // what every action is expected to cost, in time and memory
+        std::vector<std::vector<long long>> costs(targets.size());
+        std::vector<std::vector<long long>> memories(targets.size());
+        for (size_t i = 0; i < targets.size(); i++) {
+            if (!wanted[i]) continue;
+            const Target& t = targets[i];
+            std::map<std::string, ActionState> history = readBuildState(t.path / "build" / "cache" / (t.name + ".state"));
+            std::unique_ptr<IncludeScanner> scanner;
+            for (const Action& a : t.actions) {
+                auto it = history.find(actionKey(a));
+                costs[i].push_back(it != history.end() && it->second.ms >= 0 ? it->second.ms : estimateActionMs(a, scanner, t));
+                memories[i].push_back(it != history.end() && it->second.rss >= 0 ? it->second.rss : BSCF_UNKNOWN_JOB_MEMORY);
+            }
+        }
+        std::vector<std::vector<bool>> skip = shardSkips(wanted);
+        for (size_t i = 0; i < targets.size(); i++) {
+            if (!wanted[i]) continue;
+            const Target& t = targets[i];
+            TargetRun* run = (runs[i] = std::make_unique<TargetRun>()).get();
+            bool forceThis = forceRoots && isRoot[i];
+            startJob[i] = scheduler.add([this, &t, run, forceThis] { return startTarget(t, *run, forceThis); });
+            headersJob[i] = scheduler.add([] { return true; }, true);
+            doneJob[i] = scheduler.add([this, &t, run] { return finishTarget(t, *run); }, true);
+            for (size_t k = 0; k < t.actions.size(); k++) {
+                const Action& a = t.actions[k];
+                size_t job;
+                if (skip[i][k]) {
+                    // another shard's (or the merge's)
+                    job = scheduler.add([] { return true; }, true);
+                } else {
+                    job = scheduler.add([this, &t, run, &a] { return runAction(t, *run, a); }, false, costs[i][k], actionLabel(t, a), memories[i][k]);
+                }
+                if (workerSlots > 0 && !distributable(a)) scheduler.addToPool(job, localPool);
+                std::string pool = actionPool(t, a);
+                if (!pool.empty() && !skip[i][k]) {
+                    auto p = pools.find(pool);
+                    if (p != pools.end()) {
+                        scheduler.addToPool(job, p->second);
+                    } else if (pool != "link") {
+                        // the link pool is only limited if it's declared
+                        std::cout << "Pool " << pool << " of " << t.name << " is not declared (POOL " << pool << " N)" << std::endl;
                         return false;
                     }
                 }
-                return true;
+                actionJobs[i].push_back(job);
+                if (!a.bmi.empty()) producer[a.bmi] = job;
+                if (a.type == ActionType::PCH) producer[a.output] = job;
+            }
+        }
+        for (size_t i = 0; i < targets.size(); i++) {
+            if (!wanted[i]) continue;
+            const Target& t = targets[i];
+            std::vector<size_t> deps = allDependencies(i);
+            bool hasPrebuild = false;
+            for (const Action& a : t.actions) {
+                if (a.type == ActionType::PREBUILD) hasPrebuild = true;
+            }
+            if (hasPrebuild || !t.revision.empty()) {
+                for (size_t d : deps) scheduler.depend(startJob[i], doneJob[d]);
+            } else {
+                // the headers of the dependencies, their dependencies' come with them
+                for (const std::string& dep : t.dependencies) {
+                    int d = findTarget(dep);
+                    if (d >= 0) scheduler.depend(startJob[i], headersJob[d]);
+                }
+            }
+            scheduler.depend(headersJob[i], startJob[i]);
+            scheduler.depend(doneJob[i], headersJob[i]);
+            size_t lastPrebuild = startJob[i];
+            size_t lastPostbuild = startJob[i];
+            for (size_t k = 0; k < t.actions.size(); k++) {
+                const Action& a = t.actions[k];
+                size_t job = actionJobs[i][k];
+                scheduler.depend(job, startJob[i]);
+                scheduler.depend(doneJob[i], job);
+                switch (a.type) {
+                    case ActionType::PREBUILD:
+                        scheduler.depend(job, lastPrebuild);
+                        scheduler.depend(headersJob[i], job);
+                        lastPrebuild = job;
+                        break;
+                    case ActionType::PCH:
+                    case ActionType::COMPILE:
+                        scheduler.depend(job, headersJob[i]);
+                        for (const std::string& in : a.inputs) {
+                            auto it = producer.find(in);
+                            if (it != producer.end()) scheduler.depend(job, it->second);
+                        }
+                        break;
+                    case ActionType::ARCHIVE:
+                    case ActionType::LINK:
+                        for (size_t c = 0; c < t.actions.size(); c++) {
+                            if (t.actions[c].type == ActionType::COMPILE) scheduler.depend(job, actionJobs[i][c]);
+                        }
+                        if (a.type == ActionType::LINK) {
+                            for (size_t d : deps) scheduler.depend(job, doneJob[d]);
+                        }
+                        break;
+                    case ActionType::COPY:
+                        scheduler.depend(job, headersJob[i]);
+                        for (size_t d : deps) scheduler.depend(job, doneJob[d]);
+                        break;
+                    case ActionType::POSTBUILD:
+                        for (size_t c = 0; c < t.actions.size(); c++) {
+                            if (t.actions[c].type != ActionType::POSTBUILD) scheduler.depend(job, actionJobs[i][c]);
+                        }
+                        scheduler.depend(job, lastPostbuild);
+                        lastPostbuild = job;
+                        break;
+                }
             }
         }
-        std::cout << "Target " << target << " not found" << std::endl;
-        return false;
+        bool ok = scheduler.run(jobs + workerSlots);
+        if (critPath) {
+            std::lock_guard<std::mutex> lock(bscfOutputMutex);
+            scheduler.printCriticalPath(std::cout);
+        }
+        // targets that failed (or whose dependencies did) still keep what did get built
+        for (const std::unique_ptr<TargetRun>& run : runs) {
+            if (run && !run->skipped && !run->finished && !run->statePath.empty()) writeBuildState(run->statePath, run->next);
+        }
+        return ok;
+    }
+
+public:
+    bscfBuilder(const std::vector<Target>& targets, const Compiler& c) {
+        this->targets = targets;
+        this->fingerprint = compilerFingerprint(c);
+        this->compilerType = c.type;
+    }
+
+    bool build() {
+        std::vector<size_t> all;
+        for (size_t i = 0; i < targets.size(); i++) all.push_back(i);
+        return buildTargets(all, false);
+    }
+
+    bool buildTarget(const std::string& target) {
+        int i = findTarget(target);
+        if (i < 0) {
+            std::cout << "Target " << target << " not found" << std::endl;
+            return false;
+        }
+        return buildTargets({(size_t)i}, true);
     }
 
 public:
     bool echo = false;
     bool force = false;
+    size_t jobs = defaultJobCount(); // actions running at once
+    bool critPath = false; // print the critical path after the build
+    size_t shard = 0; // --shard K/N, 1 based, 0 for the whole build
+    size_t shards = 0;
 };
 
 int main(int argc, char* argv[]) {
@@ -966,6 +1975,10 @@ int main(int argc, char* argv[]) {
     int retval = 0;
     bool echo = false;
     bool force = false;
+    size_t jobs = defaultJobCount();
+    bool critPath = false;
+    size_t shard = 0;
+    size_t shards = 0;
 
     std::path p = ".";
     Compiler c = defaultCompiler();
@@ -975,7 +1988,7 @@ int main(int argc, char* argv[]) {
         if (strcmp(argv[1], "NOUPDATE") == 0) {
             // build current project then exit (used for auto update)
             std::vector<Target> targets = bscfGenCache(p, c);
-            bscfBuilder builder(targets);
+            bscfBuilder builder(targets, c);
             builder.force = true;
             builder.build();
             return 0;
@@ -983,7 +1996,21 @@ int main(int argc, char* argv[]) {
         p = argv[1];
     }
 
-    versionSystem();
+    // everything runs from the project root, so commands only hold paths relative to it
+    // (and two checkouts in different places produce the same commands, see filePrefixMapFlag)
+    if (!std::is_directory(p)) {
+        std::cout << "Project directory " << p << " does not exist" << std::endl;
+        return 1;
+    }
+    std::filesystem::current_path(p);
+    p = ".";
+
+    // selfupdate fetches bscf_repo itself, a background fetch would race with it
+    bool selfUpdating = false;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "selfupdate") == 0) selfUpdating = true;
+    }
+    versionSystem(!selfUpdating);
 
     if (argc > 2) {
         for (int i = 2; i < argc; i++) {
@@ -991,11 +2018,24 @@ int main(int argc, char* argv[]) {
         }
     }
 
+    // --trace file goes anywhere, it covers everything after it's read (see trace.h)
+    for (size_t i = 0; i < commands.size(); i++) {
+        if (commands[i] != "--trace") continue;
+        if (i + 1 >= commands.size()) {
+            std::cout << "--trace needs a file" << std::endl;
+            return 1;
+        }
+        startTrace(commands[i + 1]);
+        commands.erase(commands.begin() + i, commands.begin() + i + 2);
+        break;
+    }
+
     if (commands.empty()) {
         commands.emplace_back("build");
     }
 
-    for (const std::string& com : commands) {
+    for (size_t i = 0; i < commands.size(); i++) {
+        const std::string& com = commands[i];
         if (com == "clean" || com == "c") {
             std::vector<Target> targets = bscfInclude(p, c);
             for (Target& t : targets) {
@@ -1012,13 +2052,29 @@ int main(int argc, char* argv[]) {
                 std::remove_all(t.path / "build" / "cache");
             }
         } else if (com == "build" || com == "b") {
+            // build --shard K/N, the shard can come after build too
+            if (i + 2 < commands.size() && commands[i + 1] == "--shard") {
+                if (!parseShard(commands[i + 2], shard, shards)) {
+                    std::cout << "Invalid shard: " << commands[i + 2] << " (K/N, 1 <= K <= N)" << std::endl;
+                    return 1;
+                }
+                i += 2;
+            }
+            if (shards > 0 && !objCacheEnabled) {
+                std::cout << "--shard needs the object cache, the shards publish what they compile there" << std::endl;
+                return 1;
+            }
             std::cout << "Generating build files... ";
             std::vector<Target> targets = bscfGenCache(p, c);
             std::cout << "Done" << std::endl;
 
-            bscfBuilder builder(targets);
+            bscfBuilder builder(targets, c);
             builder.echo = echo;
             builder.force = force;
+            builder.jobs = jobs;
+            builder.critPath = critPath;
+            builder.shard = shard;
+            builder.shards = shards;
             bool f = builder.build();
             if (!f) {
                 retval = 1;
@@ -1037,6 +2093,234 @@ int main(int argc, char* argv[]) {
             echo = true;
         } else if (com == "noecho" || com == "ne") {
             echo = false;
+        } else if (com == "prefetch") {
+            // bscf . prefetch [target(s)]: pull everything the remote cache has for these targets (all if none given) into the local cache
+            std::vector<Target> targets = bscfGenCache(p, c);
+            std::vector<std::string> wanted;
+            while (i + 1 < commands.size()) {
+                bool isTarget = false;
+                for (const Target& t : targets) {
+                    if (t.name == commands[i + 1]) isTarget = true;
+                }
+                if (!isTarget) break;
+                wanted.push_back(commands[++i]);
+            }
+            if (!remoteCacheEnabled()) {
+                std::cout << "No remote cache, set BSCF_REMOTE_CACHE" << std::endl;
+                retval = 1;
+                continue;
+            }
+            std::string fingerprint = compilerFingerprint(c);
+            int local = 0;
+            int fetched = 0;
+            int missing = 0;
+            for (const Target& t : targets) {
+                if (!wanted.empty() && std::find(wanted.begin(), wanted.end(), t.name) == wanted.end()) continue;
+                for (const Action& a : t.actions) {
+                    if (a.type != ActionType::COMPILE) continue;
+                    int r = prefetchCompile({a.cmd, a.source, a.output, a.depfile, fingerprint, a.keyExtra, "", false});
+                    if (r == 0) local++;
+                    else if (r == 1) fetched++;
+                    else missing++;
+                }
+            }
+            std::cout << "Prefetched " << fetched << " objects (" << local << " already local, " << missing << " not in the remote cache)" << std::endl;
+        } else if (com == "pchsuggest") {
+            // bscf . pchsuggest [target(s)]: which headers are worth precompiling (see pch.h)
+            std::vector<Target> targets = bscfGenCache(p, c);
+            std::vector<std::string> wanted;
+            while (i + 1 < commands.size()) {
+                bool isTarget = false;
+                for (const Target& t : targets) {
+                    if (t.name == commands[i + 1]) isTarget = true;
+                }
+                if (!isTarget) break;
+                wanted.push_back(commands[++i]);
+            }
+            for (const Target& t : targets) {
+                if (!wanted.empty() && std::find(wanted.begin(), wanted.end(), t.name) == wanted.end()) continue;
+                if (!t.revision.empty() && wanted.empty()) continue; // third party libraries are built once anyway
+                std::vector<PchSource> sources;
+                for (const Action& a : t.actions) {
+                    std::string ext = std::path(a.source).extension().string();
+                    if (a.type == ActionType::COMPILE && (ext == ".cpp" || ext == ".cxx")) {
+                        sources.push_back({a.source, a.depfile});
+                    }
+                }
+                if (sources.empty()) continue;
+                suggestPch(t.name, sources, c.cxx, bscfCompileFlags(t, targets), t.path / "build" / "cache" / "pchprobe.cpp");
+            }
+        } else if (com == "affected") {
+            // bscf . affected header: which sources include it (see scanner.h)
+            if (i + 1 >= commands.size()) {
+                std::cout << "Usage: bscf . affected [header]" << std::endl;
+                retval = 1;
+                continue;
+            }
+            std::string header = std::path(commands[++i]).lexically_normal().string();
+            std::vector<Target> targets = bscfGenCache(p, c);
+            int count = 0;
+            for (const Target& t : targets) {
+                IncludeScanner scanner(bscfResolveIncludes(t, targets));
+                std::vector<std::string> sources;
+                for (const std::string& source : t.sources) {
+                    std::string ext = std::path(source).extension().string();
+                    if (ext != ".c" && ext != ".cc" && ext != ".cpp" && ext != ".cxx" && !isModuleSourceExt(ext)) continue;
+                    for (const std::string& inc : scanner.closure(source)) {
+                        // a bare name matches that header in any directory
+                        if (inc == header || (header.find('/') == std::string::npos && std::path(inc).filename() == header)) {
+                            sources.push_back(std::path(source).lexically_normal().string());
+                            break;
+                        }
+                    }
+                }
+                if (sources.empty()) continue;
+                std::cout << t.name << ":" << std::endl;
+                for (const std::string& source : sources) {
+                    std::cout << "  " << source << std::endl;
+                }
+                count += (int)sources.size();
+            }
+            std::cout << header << " affects " << count << " source" << (count == 1 ? "" : "s") << std::endl;
+        } else if (com == "scanbench") {
+            // bscf . scanbench [target(s)]: the include scanner against -MM (see scanner.h)
+            std::vector<Target> targets = bscfGenCache(p, c);
+            std::vector<std::string> wanted;
+            while (i + 1 < commands.size()) {
+                bool isTarget = false;
+                for (const Target& t : targets) {
+                    if (t.name == commands[i + 1]) isTarget = true;
+                }
+                if (!isTarget) break;
+                wanted.push_back(commands[++i]);
+            }
+            if (c.type == CompilerType::MSVC) {
+                std::cout << "scanbench needs a compiler with -MM (gnu or clang)" << std::endl;
+                retval = 1;
+                continue;
+            }
+            for (const Target& t : targets) {
+                if (!wanted.empty() && std::find(wanted.begin(), wanted.end(), t.name) == wanted.end()) continue;
+                std::vector<std::string> sources;
+                for (const std::string& source : t.sources) {
+                    std::string ext = std::path(source).extension().string();
+                    if (ext == ".c" || ext == ".cc" || ext == ".cpp" || ext == ".cxx") sources.push_back(source);
+                }
+                if (sources.empty()) continue;
+                // the scanner, cold
+                auto start = std::chrono::steady_clock::now();
+                IncludeScanner scanner(bscfResolveIncludes(t, targets));
+                std::vector<std::vector<std::string>> scanned;
+                for (const std::string& source : sources) {
+                    scanned.push_back(scanner.closure(source));
+                }
+                long long scanUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+                // the compiler's preprocessor
+                std::string flags = bscfCompileFlags(t, targets);
+                long long mmUs = 0;
+                long long both = 0;
+                long long onlyMM = 0;
+                long long onlyScanner = 0;
+                int failedMM = 0;
+                for (size_t k = 0; k < sources.size(); k++) {
+                    std::string ext = std::path(sources[k]).extension().string();
+                    std::string compiler = ext == ".c" || ext == ".cc" ? c.cc : c.cxx;
+                    start = std::chrono::steady_clock::now();
+                    int status = 0;
+                    std::string out = runCapture(compiler + " -MM " + sources[k] + flags + BSCF_NULL_STDERR, &status);
+                    mmUs += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+                    if (status != 0) {
+                        failedMM++;
+                        continue;
+                    }
+                    std::set<std::string> mm;
+                    for (const std::string& dep : parseDepfile(out)) {
+                        std::string normal = std::path(dep).lexically_normal().string();
+                        if (normal != std::path(sources[k]).lexically_normal().string()) mm.insert(normal);
+                    }
+                    for (const std::string& header : scanned[k]) {
+                        if (mm.erase(header)) both++;
+                        else onlyScanner++;
+                    }
+                    onlyMM += (long long)mm.size();
+                }
+                std::cout << "scanbench " << t.name << ": " << sources.size() << " sources" << std::endl;
+                std::cout << "  scanner:  " << std::fixed << std::setprecision(2) << scanUs / 1000.0 << " ms ("
+                          << formatSize(scanner.bytesScanned) << " scanned)" << std::endl;
+                std::cout << "  -MM:      " << mmUs / 1000.0 << " ms";
+                if (scanUs > 0) std::cout << " (" << std::setprecision(0) << (double)mmUs / (double)scanUs << "x slower)";
+                std::cout << std::endl;
+                std::cout << "  headers:  " << both << " found by both, " << onlyMM << " only by -MM, " << onlyScanner << " only by the scanner" << std::endl;
+                if (failedMM > 0) std::cout << "  (-MM failed for " << failedMM << " sources)" << std::endl;
+                std::cout.unsetf(std::ios::fixed);
+                std::cout << std::setprecision(6);
+            }
+        } else if (com == "cacheserver") {
+            // bscf . cacheserver [port] [dir]
+            int port = BSCF_DEFAULT_CACHE_SERVER_PORT;
+            std::path dir = bscfHomeDir() / "cache-server";
+            if (i + 1 < commands.size()) {
+                try {
+                    port = std::stoi(commands[++i]);
+                } catch (...) {
+                    std::cerr << "Invalid port: " << commands[i] << std::endl;
+                    return 1;
+                }
+            }
+            if (i + 1 < commands.size()) {
+                dir = commands[++i];
+            }
+            return runCacheServer(port, dir);
+        } else if (com == "worker") {
+            // bscf . [-j N] worker [unix:/path or port]
+            std::string address;
+            if (i + 1 < commands.size()) {
+                address = commands[++i];
+            }
+            return runWorker(address, jobs);
+        } else if (com == "cache") {
+            i += cacheCommand(commands, i, retval);
+        } else if (com == "nocache") {
+            objCacheEnabled = false;
+        } else if (com == "selfupdate") {
+            selfUpdate();
+        } else if (com == "updaterecipes" || com == "ur") {
+            if (!refreshBuiltinRecipes()) {
+                retval = 1;
+            }
+        } else if (com == "-j" || com.rfind("-j", 0) == 0) {
+            // -j N or -jN
+            std::string n = com.size() > 2 ? com.substr(2) : (i + 1 < commands.size() ? commands[++i] : "");
+            size_t count = 0;
+            if (!parseCount(n, count) || count == 0) {
+                std::cout << "Invalid job count: " << n << std::endl;
+                return 1;
+            }
+            if (count > BSCF_MAX_JOBS) {
+                std::cout << "-j " << count << " is more than bscf runs at once, using -j " << BSCF_MAX_JOBS << std::endl;
+                count = BSCF_MAX_JOBS;
+            }
+            jobs = count;
+        } else if (com == "-d") {
+            // -d critpath, -d stats
+            std::string mode = i + 1 < commands.size() ? commands[++i] : "";
+            if (mode == "critpath") {
+                critPath = true;
+            } else if (mode == "stats") {
+                if (!startStats()) std::cout << "This bscf was built without BSCF_STATS, -d stats has nothing to count" << std::endl;
+            } else {
+                std::cout << "Unknown debug mode: " << mode << " (critpath, stats)" << std::endl;
+                return 1;
+            }
+        } else if (com == "--shard") {
+            if (i + 1 >= commands.size() || !parseShard(commands[++i], shard, shards)) {
+                std::cout << "Invalid shard (K/N, 1 <= K <= N)" << std::endl;
+                return 1;
+            }
+            if (!objCacheEnabled) {
+                std::cout << "--shard needs the object cache, the shards publish what they compile there" << std::endl;
+                return 1;
+            }
         } else if (com == "force" || com == "f") {
             force = true;
         } else if (com == "noforce" || com == "nf") {
@@ -1045,9 +2329,13 @@ int main(int argc, char* argv[]) {
             std::cout << "Generating build files... ";
             std::vector<Target> targets = bscfGenCache(p, c);
             std::cout << "Done" << std::endl;
-            bscfBuilder builder(targets);
+            bscfBuilder builder(targets, c);
             builder.echo = echo;
             builder.force = force;
+            builder.jobs = jobs;
+            builder.critPath = critPath;
+            builder.shard = shard;
+            builder.shards = shards;
             bool f = builder.buildTarget(com);
             if (!f) {
                 retval = 1;
@@ -1055,5 +2343,7 @@ int main(int argc, char* argv[]) {
         }
     }
 
+    flushObjCacheStats();
+    flushRemoteUploads();
     return retval;
 }
@@ -0,0 +1,192 @@
+#pragma once
+#ifndef SRC_MODULES_H
+#define SRC_MODULES_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+
+#include "util.h"
+#include "compiler.h"
+
+// c++20 named modules
+// .cppm/.ixx/.mpp/.cxxm are module sources, .cpp/.cxx files can import modules (or implement one) too
+// every c++ source is scanned for its module declaration and imports (scanModuleSource), which gives the edges between compiles:
+// the compile that provides a module writes its BMI (compiled interface) to target/build/modules/, and everything importing it
+// runs after that and has the BMI as an input, so a module change that leaves the BMI the same doesn't recompile the importers
+// the BMI is stored in the object cache next to the object, so a hit restores both
+// modules of dependencies can be imported too, their BMIs are already there since dependencies are built first
+// how the compiler finds the BMIs:
+//     gcc: -fmodules-ts -fmodule-mapper=target/build/modules/target.map, which maps every visible module to its .gcm
+//     clang: -fprebuilt-module-path for every module dir, the interface writes its .pcm with -fmodule-output
+//     msvc: -ifcSearchDir for every module dir, the interface writes its .ifc with -ifcOutput
+// import std; compiles the std module the toolchain ships (gcc 15, clang 18 with libc++, msvc 17.5) into the target first
+// header units (import <vector>;) aren't supported
+// a PCH goes in with -include, which would come before the module declaration, so module units don't get it
+// (plain sources that import modules still do)
+// the scan is textual, so an import inside #if is always counted (that only adds an edge, it doesn't break anything)
+// the compilers' own scanners (P1689 from clang-scan-deps, gcc 14 -fdeps-format) would get that right, but need a newer toolchain than bscf requires
+
+struct ModuleScan {
+    std::string provides; // module (or partition, "m:part") this source compiles into a BMI, empty if none
+    bool interface = false; // export module ..., as opposed to an internal partition
+    bool unit = false; // has a module declaration (interface, partition or implementation), it has to come first
+    std::vector<std::string> imports; // full names, partitions included, "std" for import std;
+};
+
+bool isModuleSourceExt(const std::string& ext) {
+    return ext == ".cppm" || ext == ".ixx" || ext == ".mpp" || ext == ".cxxm";
+}
+
+// source text with comments and string/char literals blanked out, so "import x;" in a comment doesn't count
+std::string stripCommentsAndStrings(const std::string& s) {
+    std::string out;
+    out.reserve(s.size());
+    for (size_t i = 0; i < s.size(); i++) {
+        if (s[i] == '/' && i + 1 < s.size() && s[i + 1] == '/') {
+            while (i < s.size() && s[i] != '\n') i++;
+            out += '\n';
+        } else if (s[i] == '/' && i + 1 < s.size() && s[i + 1] == '*') {
+            i += 2;
+            while (i + 1 < s.size() && !(s[i] == '*' && s[i + 1] == '/')) {
+                if (s[i] == '\n') out += '\n';
+                i++;
+            }
+            i++;
+            out += ' ';
+        } else if ((s[i] == '"' || s[i] == '\'') && !(i > 0 && (isalnum((unsigned char)s[i - 1]) || s[i - 1] == '_'))) {
+            // a literal, kept as "" so import "header"; still looks like a header unit
+            char quote = s[i];
+            out += quote;
+            i++;
+            while (i < s.size() && s[i] != quote && s[i] != '\n') {
+                if (s[i] == '\\') i++;
+                i++;
+            }
+            out += quote;
+        } else {
+            out += s[i];
+        }
+    }
+    return out;
+}
+
+ModuleScan scanModuleSource(const std::path& p) {
+    BSCF_STAT_TIME(Stat::LEXER);
+    BSCF_STAT_ADD(Stat::LEXER, 1);
+    ModuleScan scan;
+    std::string module; // the module this source belongs to, for import :part;
+    // preprocessor lines go (module; is usually followed by #includes), what's left is split into declarations
+    std::stringstream lines(stripCommentsAndStrings(readFile(p)));
+    std::string text;
+    std::string line;
+    while (std::getline(lines, line)) {
+        size_t i = line.find_first_not_of(" \t");
+        if (i != std::string::npos && line[i] == '#') continue;
+        text += line + "\n";
+    }
+    std::stringstream ss(text);
+    std::string decl;
+    while (std::getline(ss, decl, ';')) {
+        // import can follow a function body in a plain source
+        decl = decl.substr(std::min(decl.size(), decl.find_last_of("{}") + 1));
+        std::stringstream words(decl);
+        std::vector<std::string> tokens;
+        std::string word;
+        while (words >> word) tokens.push_back(word);
+        size_t start = 0;
+        bool exported = !tokens.empty() && tokens[0] == "export";
+        if (exported) start++;
+        if (start >= tokens.size()) continue;
+        std::string name;
+        for (size_t i = start + 1; i < tokens.size(); i++) name += tokens[i];
+        if (tokens[start] == "module") {
+            if (name.empty() || name == ":private") continue; // global module fragment, private fragment
+            module = name.substr(0, name.find(':'));
+            scan.unit = true;
+            if (exported || name.find(':') != std::string::npos) {
+                scan.provides = name;
+                scan.interface = exported;
+            } else {
+                // an implementation unit imports its interface
+                scan.imports.push_back(name);
+            }
+        } else if (tokens[start] == "import" && !name.empty()) {
+            if (name[0] == '<' || name[0] == '"') {
+                std::cerr << "Header units are not supported: import " << name << " in " << p.string() << std::endl;
+                continue;
+            }
+            if (name[0] == ':') name = module + name;
+            scan.imports.push_back(name);
+        }
+    }
+    return scan;
+}
+
+// scans are redone only when the source changed
+ModuleScan scanModuleSourceCached(const std::string& source) {
+    static std::map<std::string, std::pair<std::filesystem::file_time_type, ModuleScan>> scans;
+    std::error_code ec;
+    auto time = std::filesystem::last_write_time(source, ec);
+    auto it = scans.find(source);
+    if (it != scans.end() && it->second.first == time) return it->second.second;
+    ModuleScan scan = scanModuleSource(source);
+    scans[source] = {time, scan};
+    return scan;
+}
+
+std::string bmiPath(const std::path& moduleDir, const std::string& module, const Compiler& c) {
+    std::string ext = c.type == CompilerType::GNU ? ".gcm" : c.type == CompilerType::CLANG ? ".pcm" : ".ifc";
+    return (moduleDir / (replace(module, ":", "-") + ext)).string();
+}
+
+// only written when it changes, it's an input of every compile that uses modules
+void writeModuleMapper(const std::path& p, const std::map<std::string, std::string>& bmis) {
+    std::create_directories(p.parent_path());
+    std::string contents;
+    for (const auto& [module, bmi] : bmis) {
+        contents += module + " " + bmi + "\n";
+    }
+    if (!std::exists(p) || readFile(p) != contents) {
+        writeFileAtomic(p, contents);
+    }
+}
+
+// the std module source the toolchain ships, empty if it has none
+std::string stdModuleSource(const Compiler& c) {
+    static std::map<std::string, std::string> found;
+    auto it = found.find(c.cxx);
+    if (it != found.end()) return it->second;
+    std::string source;
+    if (c.type == CompilerType::MSVC) {
+        const char* tools = std::getenv("VCToolsInstallDir");
+        if (tools && std::exists(std::path(tools) / "modules" / "std.ixx")) source = (std::path(tools) / "modules" / "std.ixx").string();
+    } else {
+        // the manifest next to the standard library says where the module source is
+        std::string manifest = c.type == CompilerType::GNU ? "libstdc++.modules.json" : "libc++.modules.json";
+        int status = 0;
+        std::string out = runCapture(c.cxx + " -print-file-name=" + manifest, &status);
+        out.erase(out.find_last_not_of(" \r\n") + 1);
+        if (status == 0 && out != manifest && std::exists(out)) {
+            std::string json = readFile(out);
+            size_t name = json.find("\"std\"", json.find("\"logical-name\""));
+            size_t key = json.rfind('{', name);
+            key = json.find("\"source-path\"", key == std::string::npos ? 0 : key);
+            size_t start = json.find('"', json.find(':', key) + 1);
+            size_t end = json.find('"', start + 1);
+            if (name != std::string::npos && key != std::string::npos && start != std::string::npos && end != std::string::npos) {
+                std::path p = std::path(out).parent_path() / json.substr(start + 1, end - start - 1);
+                if (std::exists(p)) source = p.lexically_normal().string();
+            }
+        }
+    }
+    found[c.cxx] = source;
+    return source;
+}
+
+#endif //SRC_MODULES_H
@@ -0,0 +1,260 @@
+#pragma once
+#ifndef SRC_NET_H
+#define SRC_NET_H
+
+#include <string>
+#include <sstream>
+#include <cstring>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef SOCKET bscfSocket;
+#define BSCF_BAD_SOCKET INVALID_SOCKET
+#define bscfCloseSocket closesocket
+#else
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/un.h>
+#include <unistd.h>
+typedef int bscfSocket;
+#define BSCF_BAD_SOCKET (-1)
+#define bscfCloseSocket close
+#endif
+
+#ifdef MSG_NOSIGNAL
+#define BSCF_SEND_FLAGS MSG_NOSIGNAL // a server hanging up shouldn't kill us with SIGPIPE
+#else
+#define BSCF_SEND_FLAGS 0
+#endif
+
+#include "util.h"
+
+// just enough sockets and http for the remote cache (and its little reference server), and the sockets compile workers use
+// http/1.0, one request per connection, no https, no chunked encoding
+
+void netInit() {
+#ifdef _WIN32
+    static bool done = false;
+    if (!done) {
+        WSADATA data;
+        WSAStartup(MAKEWORD(2, 2), &data);
+        done = true;
+    }
+#endif
+}
+
+void setSocketTimeout(bscfSocket s, int seconds) {
+#ifdef _WIN32
+    DWORD ms = seconds * 1000;
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (const char*)&ms, sizeof(ms));
+    setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, (const char*)&ms, sizeof(ms));
+#else
+    timeval tv{};
+    tv.tv_sec = seconds;
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+#endif
+}
+
+// returns BSCF_BAD_SOCKET if it can't connect
+bscfSocket netConnect(const std::string& host, int port, int timeoutSeconds = 10) {
+    netInit();
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* res = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &res) != 0) {
+        return BSCF_BAD_SOCKET;
+    }
+    bscfSocket s = BSCF_BAD_SOCKET;
+    for (addrinfo* ai = res; ai; ai = ai->ai_next) {
+        s = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (s == BSCF_BAD_SOCKET) continue;
+        setSocketTimeout(s, timeoutSeconds);
+        if (connect(s, ai->ai_addr, (int)ai->ai_addrlen) == 0) break;
+        bscfCloseSocket(s);
+        s = BSCF_BAD_SOCKET;
+    }
+    freeaddrinfo(res);
+    return s;
+}
+
+// listens on 127.0.0.1 only, port 0 picks a free one (written back into port)
+bscfSocket netListenLocal(int& port) {
+    netInit();
+    bscfSocket s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s == BSCF_BAD_SOCKET) return s;
+    int yes = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char*)&yes, sizeof(yes));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons((unsigned short)port);
+    if (bind(s, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(s, 64) != 0) {
+        bscfCloseSocket(s);
+        return BSCF_BAD_SOCKET;
+    }
+    socklen_t len = sizeof(addr);
+    getsockname(s, (sockaddr*)&addr, &len);
+    port = ntohs(addr.sin_port);
+    return s;
+}
+
+#ifndef _WIN32
+// a unix domain socket, BSCF_BAD_SOCKET if it can't connect
+bscfSocket netConnectUnix(const std::string& path, int timeoutSeconds = 10) {
+    sockaddr_un addr{};
+    if (path.size() >= sizeof(addr.sun_path)) return BSCF_BAD_SOCKET;
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path.c_str());
+    bscfSocket s = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s == BSCF_BAD_SOCKET) return s;
+    setSocketTimeout(s, timeoutSeconds);
+    if (connect(s, (sockaddr*)&addr, sizeof(addr)) != 0) {
+        bscfCloseSocket(s);
+        return BSCF_BAD_SOCKET;
+    }
+    return s;
+}
+
+// replaces a stale socket file left by a server that's gone
+bscfSocket netListenUnix(const std::string& path) {
+    sockaddr_un addr{};
+    if (path.size() >= sizeof(addr.sun_path)) return BSCF_BAD_SOCKET;
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path.c_str());
+    bscfSocket s = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s == BSCF_BAD_SOCKET) return s;
+    unlink(path.c_str());
+    if (bind(s, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(s, 64) != 0) {
+        bscfCloseSocket(s);
+        return BSCF_BAD_SOCKET;
+    }
+    return s;
+}
+#endif
+
+bool netSendAll(bscfSocket s, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        int n = send(s, data.data() + sent, (int)(data.size() - sent), BSCF_SEND_FLAGS);
+        if (n <= 0) return false;
+        sent += (size_t)n;
+    }
+    return true;
+}
+
+// reads exactly len bytes, false if the connection closed first
+bool netRecvExact(bscfSocket s, std::string& out, size_t len) {
+    char buffer[65536];
+    while (out.size() < len) {
+        size_t want = std::min(sizeof(buffer), len - out.size());
+        int n = recv(s, buffer, (int)want, 0);
+        if (n <= 0) return false;
+        out.append(buffer, (size_t)n);
+    }
+    return true;
+}
+
+// reads up to and including the blank line after the headers
+// anything read past it ends up in rest
+bool netRecvHeaders(bscfSocket s, std::string& headers, std::string& rest) {
+    std::string data;
+    char buffer[4096];
+    while (true) {
+        size_t end = data.find("\r\n\r\n");
+        if (end != std::string::npos) {
+            headers = data.substr(0, end + 4);
+            rest = data.substr(end + 4);
+            return true;
+        }
+        if (data.size() > 64 * 1024) return false;
+        int n = recv(s, buffer, sizeof(buffer), 0);
+        if (n <= 0) return false;
+        data.append(buffer, (size_t)n);
+    }
+}
+
+long long httpContentLength(const std::string& headers) {
+    std::stringstream ss(headers);
+    std::string line;
+    while (std::getline(ss, line)) {
+        std::string lower = line;
+        std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+        if (lower.rfind("content-length:", 0) == 0) {
+            try {
+                return std::stoll(strip(line.substr(15)));
+            } catch (...) {
+                return -1;
+            }
+        }
+    }
+    return -1;
+}
+
+struct HttpUrl {
+    std::string host;
+    int port = 80;
+    std::string path; // always starts with /
+};
+
+bool parseHttpUrl(const std::string& url, HttpUrl& out) {
+    if (url.rfind("http://", 0) != 0) return false;
+    std::string rest = url.substr(7);
+    size_t slash = rest.find('/');
+    std::string hostPort = rest.substr(0, slash);
+    out.path = slash == std::string::npos ? "/" : rest.substr(slash);
+    size_t colon = hostPort.rfind(':');
+    if (colon != std::string::npos) {
+        out.host = hostPort.substr(0, colon);
+        try {
+            out.port = std::stoi(hostPort.substr(colon + 1));
+        } catch (...) {
+            return false;
+        }
+    } else {
+        out.host = hostPort;
+    }
+    return !out.host.empty();
+}
+
+// returns the http status, or -1 if we couldn't talk to the server
+int httpRequest(const std::string& method, const std::string& url, const std::string& body, std::string& response) {
+    HttpUrl u;
+    if (!parseHttpUrl(url, u)) return -1;
+    bscfSocket s = netConnect(u.host, u.port);
+    if (s == BSCF_BAD_SOCKET) return -1;
+    std::string req = method + " " + u.path + " HTTP/1.0\r\n";
+    req += "Host: " + u.host + "\r\n";
+    req += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+    req += "Connection: close\r\n\r\n";
+    int status = -1;
+    std::string headers;
+    std::string rest;
+    if (netSendAll(s, req) && netSendAll(s, body) && netRecvHeaders(s, headers, rest)) {
+        std::stringstream ss(headers);
+        std::string version;
+        ss >> version >> status;
+        long long len = httpContentLength(headers);
+        response = rest;
+        if (len >= 0) {
+            if (!netRecvExact(s, response, (size_t)len)) status = -1;
+            response.resize(std::min(response.size(), (size_t)std::max(len, 0LL)));
+        } else {
+            // no length, read until the server closes
+            char buffer[65536];
+            int n;
+            while ((n = recv(s, buffer, sizeof(buffer), 0)) > 0) response.append(buffer, (size_t)n);
+        }
+    }
+    bscfCloseSocket(s);
+    return status;
+}
+
+#endif //SRC_NET_H
@@ -0,0 +1,502 @@
+#pragma once
+#ifndef SRC_OBJCACHE_H
+#define SRC_OBJCACHE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <filesystem>
+#include <fstream>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+
+#include "util.h"
+#include "hash.h"
+#include "depfile.h"
+#include "compress.h"
+#include "remotecache.h"
+#include "resources.h"
+#include "workers.h"
+#include "trace.h"
+
+// ccache style object cache, shared by every project of the user
+//     ~/.bscf/cache/ (or BSCF_CACHE_DIR)
+//         manifests/ab/abcd... // direct mode: which headers (and their digests) went into each result
+//         objects/ab/abcd....o // the object
+//         objects/ab/abcd....stderr // warnings from the compile, printed again on a hit
+//         objects/ab/abcd....meta // size, compile time and sha256 of the object (for stats and verify)
+//         objects/ab/abcd....bmi // the compiled module interface, for compiles that write one (see modules.h)
+// direct mode key: compiler fingerprint + normalized command + digest of the source
+//     the manifest for that key lists results together with the digests of every header that went into them (from the depfile)
+//     if all the headers still match, that's a hit without running the compiler at all
+// fallback: run the preprocessor, the key is compiler fingerprint + normalized command + digest of the preprocessed output
+// on a miss the compile runs as normal and the result is stored under the preprocessed key,
+// and added to the manifest so next time it's a direct hit
+// only gnu/clang style commands are cached (they need -MD -MF for the header list, system headers included,
+// so a manifest doesn't hit on objects built against headers a package upgrade has since replaced)
+// BSCF_NOCACHE=1 (or the nocache command) turns it off
+// with BSCF_REMOTE_CACHE set, misses are looked up in the remote cache too, and new entries are uploaded (see remotecache.h)
+// every file is written to a temp name and renamed into place, so readers never see half an entry,
+// and an entry evicted while someone is reading it just turns into a miss for them
+
+const std::string BSCF_OBJCACHE_VERSION = "bscf-objcache 1";
+
+struct CompileJob {
+    std::string cmd; // the full compile command
+    std::string source;
+    std::string object;
+    std::string depfile;
+    std::string fingerprint; // compilerFingerprint of the compiler in cmd
+    std::string extra; // what else the object depends on that cmd doesn't show, like the command of the pch it uses
+    std::string bmi; // the compiled module interface it writes besides the object, empty if none
+    bool distributable = false; // a worker can compile it from the preprocessed source (see workers.h)
+};
+
+bool objCacheEnabled = !envFlag("BSCF_NOCACHE");
+
+std::path objCacheDir() {
+    std::path dir;
+    if (const char* env = std::getenv("BSCF_CACHE_DIR")) {
+        dir = env;
+    } else {
+        dir = bscfHomeDir() / "cache";
+    }
+    std::create_directories(dir);
+    return dir;
+}
+
+// where an entry lives relative to the cache root, the remote cache uses the same layout
+std::string objCacheRel(const std::string& kind, const std::string& key, const std::string& ext = "") {
+    return kind + "/" + key.substr(0, 2) + "/" + key + ext;
+}
+
+std::path objCachePath(const std::string& kind, const std::string& key, const std::string& ext = "") {
+    std::path p = objCacheDir() / objCacheRel(kind, key, ext);
+    std::create_directories(p.parent_path());
+    return p;
+}
+
+// digests of files we already hashed this run, headers are shared by most sources
+// (compiles run on several threads, so it has a lock)
+std::map<std::string, std::string> fileDigestMemo;
+std::mutex fileDigestMutex;
+
+// called whenever something that could write sources or headers ran (prebuild steps etc)
+void invalidateFileDigests() {
+    std::lock_guard<std::mutex> lock(fileDigestMutex);
+    fileDigestMemo.clear();
+}
+
+// a file we (re)wrote ourselves
+void forgetFileDigest(const std::string& p) {
+    std::lock_guard<std::mutex> lock(fileDigestMutex);
+    fileDigestMemo.erase(p);
+}
+
+std::string fileDigest(const std::string& p) {
+    {
+        std::lock_guard<std::mutex> lock(fileDigestMutex);
+        auto it = fileDigestMemo.find(p);
+        if (it != fileDigestMemo.end()) return it->second;
+    }
+    TraceSpan span("hash", p);
+    std::string d = sha256File(p);
+    span.end();
+    std::lock_guard<std::mutex> lock(fileDigestMutex);
+    fileDigestMemo[p] = d;
+    return d;
+}
+
+// the root in -ffile-prefix-map=<root>=. differs between checkouts, what comes out of the compiler doesn't
+std::string normalizePrefixMap(std::string cmd) {
+    const std::string flag = "-ffile-prefix-map=";
+    size_t pos = cmd.find(flag);
+    while (pos != std::string::npos) {
+        size_t start = pos + flag.size();
+        size_t end = cmd.find(' ', start);
+        if (end == std::string::npos) end = cmd.size();
+        size_t eq = cmd.rfind('=', end - 1);
+        if (eq != std::string::npos && eq >= start) {
+            cmd.replace(start, eq - start, "<root>");
+            end = start + 6;
+        }
+        pos = cmd.find(flag, end);
+    }
+    return cmd;
+}
+
+// the output and depfile paths don't change what gets compiled, so they are left out of the key
+std::string normalizeCompileCmd(const CompileJob& job) {
+    std::string cmd = normalizePrefixMap(job.cmd);
+    cmd = replace(cmd, job.object, "<obj>");
+    cmd = replace(cmd, job.depfile, "<dep>");
+    return BSCF_OBJCACHE_VERSION + "\n" + job.fingerprint + "\n" + cmd + "\n" + normalizePrefixMap(job.extra) + "\n";
+}
+
+std::string directKey(const CompileJob& job) {
+    return sha256("direct\n" + normalizeCompileCmd(job) + fileDigest(job.source));
+}
+
+struct ManifestEntry {
+    std::string result;
+    std::vector<std::pair<std::string, std::string>> files; // digest, path
+};
+
+std::vector<ManifestEntry> readManifest(const std::path& p) {
+    std::vector<ManifestEntry> entries;
+    std::ifstream file(p);
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.rfind("entry ", 0) == 0) {
+            entries.push_back({line.substr(6), {}});
+        } else if (!entries.empty() && line.size() > 65) {
+            entries.back().files.emplace_back(line.substr(0, 64), line.substr(65));
+        }
+    }
+    return entries;
+}
+
+// newest entries go first, and we only keep a handful so the manifest stays small
+void addManifestEntry(const std::path& p, const std::string& result, const std::vector<std::string>& deps) {
+    std::vector<ManifestEntry> entries = readManifest(p);
+    ManifestEntry entry{result, {}};
+    for (const std::string& dep : deps) {
+        std::string d = fileDigest(dep);
+        if (d.empty()) return; // a header vanished mid build, don't record anything
+        entry.files.emplace_back(d, dep);
+    }
+    std::stringstream ss;
+    auto write = [&ss](const ManifestEntry& e) {
+        ss << "entry " << e.result << std::endl;
+        for (const auto& [digest, path] : e.files) {
+            ss << digest << " " << path << std::endl;
+        }
+    };
+    write(entry);
+    int kept = 1;
+    for (const ManifestEntry& e : entries) {
+        if (e.result == result || kept >= 16) continue;
+        write(e);
+        kept++;
+    }
+    writeFileAtomic(p, ss.str());
+}
+
+std::string lookupManifest(const std::path& p) {
+    BSCF_STAT_TIME(Stat::CACHE_LOOKUPS);
+    BSCF_STAT_ADD(Stat::CACHE_LOOKUPS, 1);
+    for (const ManifestEntry& e : readManifest(p)) {
+        bool match = true;
+        for (const auto& [digest, path] : e.files) {
+            if (fileDigest(path) != digest) {
+                match = false;
+                break;
+            }
+        }
+        if (match && std::exists(objCachePath("objects", e.result, ".o"))) {
+            return e.result;
+        }
+    }
+    return "";
+}
+
+void replayStderr(const std::path& p) {
+    if (!std::exists(p)) return;
+    std::string err = readFile(p);
+    std::lock_guard<std::mutex> lock(bscfOutputMutex);
+    if (!err.empty()) std::cerr << err;
+}
+
+// counters for this process, added to the stats file in the cache dir at exit (see cachemgmt.h)
+// atomic since compiles run on several threads
+struct ObjCacheStats {
+    std::atomic<long long> directHits{0};
+    std::atomic<long long> preprocessedHits{0};
+    std::atomic<long long> misses{0};
+    std::atomic<long long> uncached{0}; // compiles that couldn't go through the cache (msvc, cache off)
+    std::atomic<long long> bytesRestored{0};
+    std::atomic<long long> msSaved{0}; // how long the restored objects took to compile originally
+    std::atomic<long long> bytesStored{0}; // on disk, after compression
+    std::atomic<long long> remoteHits{0}; // hits (direct or preprocessed) that had to come from the remote cache
+    std::atomic<long long> targetHits{0}; // whole library targets restored from the artifact cache (artifacts.h)
+
+    void reset() {
+        for (std::atomic<long long>* counter : {&directHits, &preprocessedHits, &misses, &uncached, &bytesRestored, &msSaved,
+                                                &bytesStored, &remoteHits, &targetHits}) {
+            *counter = 0;
+        }
+    }
+};
+
+ObjCacheStats objCacheStats;
+
+// BSCF_CACHE_COMPRESS=1 compresses objects as they are stored, reading works either way
+bool objCacheCompress = envFlag("BSCF_CACHE_COMPRESS");
+
+struct ObjMeta {
+    long long size = 0; // uncompressed
+    long long ms = 0; // compile time
+    std::string digest; // sha256 of the uncompressed object
+};
+
+ObjMeta readObjMeta(const std::path& p) {
+    ObjMeta m;
+    std::ifstream file(p);
+    std::string key;
+    while (file >> key) {
+        if (key == "size") file >> m.size;
+        else if (key == "ms") file >> m.ms;
+        else if (key == "sha256") file >> m.digest;
+    }
+    return m;
+}
+
+// reads a stored object, undoing the compression if it has any
+// returns false if it's gone (evicted) or corrupt
+bool readStoredObject(const std::path& p, std::string& data) {
+    std::ifstream file(p, std::ios::binary);
+    if (!file) return false;
+    std::stringstream ss;
+    ss << file.rdbuf();
+    data = ss.str();
+    if (isCompressed(data)) {
+        std::string raw;
+        if (!decompressData(data, raw)) return false;
+        data.swap(raw);
+    }
+    return true;
+}
+
+bool restoreObject(const std::string& key, const CompileJob& job) {
+    std::path stored = objCachePath("objects", key, ".o");
+    std::string data;
+    if (!readStoredObject(stored, data)) return false;
+    if (!job.bmi.empty()) {
+        std::string bmi;
+        if (!readStoredObject(objCachePath("objects", key, ".bmi"), bmi) || !writeFileAtomic(job.bmi, bmi)) return false;
+    }
+    if (!writeFileAtomic(job.object, data)) return false;
+    std::error_code ec;
+    // recently used, this is what trimming goes by
+    std::filesystem::last_write_time(stored, std::filesystem::file_time_type::clock::now(), ec);
+    ObjMeta meta = readObjMeta(objCachePath("objects", key, ".meta"));
+    objCacheStats.bytesRestored += (long long)data.size();
+    objCacheStats.msSaved += meta.ms;
+    replayStderr(objCachePath("objects", key, ".stderr"));
+    return true;
+}
+
+void storeObject(const std::string& key, const CompileJob& job, const std::path& errFile, long long ms) {
+    std::path obj = objCachePath("objects", key, ".o");
+    std::string data = readFile(job.object);
+    if (data.empty()) return;
+    std::stringstream meta;
+    meta << "size " << data.size() << std::endl;
+    meta << "ms " << ms << std::endl;
+    meta << "sha256 " << sha256(data) << std::endl;
+    if (objCacheCompress) {
+        data = compressData(data);
+    }
+    if (!job.bmi.empty()) {
+        std::string bmi = readFile(job.bmi);
+        if (bmi.empty()) return;
+        writeFileAtomic(objCachePath("objects", key, ".bmi"), objCacheCompress ? compressData(bmi) : bmi);
+    }
+    // stderr, meta (and the bmi) go in first, the .o appearing is what makes the entry visible
+    writeFileAtomic(objCachePath("objects", key, ".stderr"), readFile(errFile));
+    writeFileAtomic(objCachePath("objects", key, ".meta"), meta.str());
+    if (writeFileAtomic(obj, data)) {
+        objCacheStats.bytesStored += (long long)data.size();
+    }
+}
+
+// pulls an entry from the remote cache into the local one, the .o goes last since that's what makes it visible
+bool fetchRemoteObject(const std::string& key) {
+    if (!remoteCacheEnabled()) return false;
+    BSCF_STAT_TIME(Stat::CACHE_LOOKUPS);
+    BSCF_STAT_ADD(Stat::CACHE_LOOKUPS, 1);
+    if (!remoteGet(objCacheRel("objects", key, ".meta"), objCachePath("objects", key, ".meta"))) return false;
+    remoteGet(objCacheRel("objects", key, ".stderr"), objCachePath("objects", key, ".stderr"));
+    remoteGet(objCacheRel("objects", key, ".bmi"), objCachePath("objects", key, ".bmi"));
+    return remoteGet(objCacheRel("objects", key, ".o"), objCachePath("objects", key, ".o"));
+}
+
+void uploadObject(const std::string& key) {
+    if (std::exists(objCachePath("objects", key, ".bmi"))) {
+        remotePutAsync(objCacheRel("objects", key, ".bmi"), objCachePath("objects", key, ".bmi"));
+    }
+    for (const std::string ext : {".stderr", ".meta", ".o"}) {
+        remotePutAsync(objCacheRel("objects", key, ext), objCachePath("objects", key, ext));
+    }
+}
+
+void uploadManifest(const std::string& dkey) {
+    remotePutAsync(objCacheRel("manifests", dkey), objCachePath("manifests", dkey));
+}
+
+std::vector<std::string> manifestDeps(const std::path& manifest, const std::string& result) {
+    std::vector<std::string> deps;
+    for (const ManifestEntry& e : readManifest(manifest)) {
+        if (e.result != result) continue;
+        for (const auto& [digest, path] : e.files) deps.push_back(path);
+        break;
+    }
+    return deps;
+}
+
+// direct mode against the remote manifest, anything that matches is copied into the local cache
+// returns the result key, or empty if the remote doesn't have a match either
+std::string remoteManifestLookup(const std::string& dkey, std::vector<std::string>& deps) {
+    if (!remoteCacheEnabled()) return "";
+    BSCF_STAT_TIME(Stat::CACHE_LOOKUPS);
+    BSCF_STAT_ADD(Stat::CACHE_LOOKUPS, 1);
+    std::path manifest = objCachePath("manifests", dkey);
+    std::path remoteManifest = manifest;
+    remoteManifest += ".remote";
+    if (!remoteGet(objCacheRel("manifests", dkey), remoteManifest)) return "";
+    std::string result;
+    for (const ManifestEntry& e : readManifest(remoteManifest)) {
+        bool match = true;
+        for (const auto& [digest, path] : e.files) {
+            if (fileDigest(path) != digest) {
+                match = false;
+                break;
+            }
+        }
+        if (!match) continue;
+        if (!std::exists(objCachePath("objects", e.result, ".o")) && !fetchRemoteObject(e.result)) continue;
+        deps.clear();
+        for (const auto& [digest, path] : e.files) deps.push_back(path);
+        addManifestEntry(manifest, e.result, deps);
+        result = e.result;
+        break;
+    }
+    std::filesystem::remove(remoteManifest);
+    return result;
+}
+
+// run a compile, capturing stderr into errFile and printing it afterwards
+bool runCompile(const std::string& cmd, const std::path& errFile, long long* peakRss = nullptr) {
+    std::string full = cmd + " 2> " + errFile.string();
+    int s = runCommand(full, peakRss);
+    replayStderr(errFile);
+    return s == 0;
+}
+
+// the -E pass of a compile, into ppFile
+std::string preprocessCmd(const CompileJob& job, const std::string& ppFile) {
+    std::string ppCmd = replace(job.cmd, " -c ", " -E ");
+    ppCmd = replace(ppCmd, " -o " + job.object, " -o " + ppFile);
+    // with -g the preprocessor writes the working directory into the output, which would tie the key to this checkout
+    return ppCmd + " -fno-working-directory";
+}
+
+// a compile that has to happen, on a worker if one has a free slot (see workers.h), here otherwise
+// ppFile is the preprocessed source if there is one already
+bool runCompileJob(const CompileJob& job, const std::path& errFile, long long* peakRss, std::string ppFile = "") {
+    int worker = workerPool().acquireAny(job.distributable && workerPool().slots() > 0);
+    if (worker >= 0) {
+        std::string own;
+        if (ppFile.empty()) {
+            own = job.object + ".i";
+            if (runCommand(preprocessCmd(job, own) + NULLIFY_CMD) == 0) ppFile = own;
+        }
+        bool ok = false;
+        bool done = !ppFile.empty() && remoteCompile(worker, job.cmd, job.source, ppFile, job.object, errFile, ok);
+        workerPool().release(worker, !done && !ppFile.empty());
+        if (!own.empty()) std::filesystem::remove(own);
+        if (done) {
+            replayStderr(errFile);
+            return ok;
+        }
+        // the worker didn't, it's compiled here once there's room
+        workerPool().acquireAny(false);
+    }
+    bool ok = runCompile(job.cmd, errFile, peakRss);
+    workerPool().releaseLocal();
+    return ok;
+}
+
+// compile through the cache, returns false if the compile failed
+// peakRss gets the compiler's peak memory if it actually ran (-1 for a cache hit)
+bool cachedCompile(const CompileJob& job, long long* peakRss = nullptr) {
+    if (peakRss) *peakRss = -1;
+    std::path errFile = job.object + ".stderr";
+    if (!objCacheEnabled || job.depfile.empty()) {
+        objCacheStats.uncached++;
+        bool ok = runCompileJob(job, errFile, peakRss);
+        std::filesystem::remove(errFile);
+        return ok;
+    }
+    TraceSpan lookup("hash", "cache key");
+    std::string dkey = directKey(job);
+    std::path manifest = objCachePath("manifests", dkey);
+    std::string result = lookupManifest(manifest);
+    lookup.end();
+    std::vector<std::string> deps;
+    bool remote = false;
+    if (!result.empty()) {
+        deps = manifestDeps(manifest, result);
+    } else {
+        result = remoteManifestLookup(dkey, deps);
+        remote = !result.empty();
+    }
+    if (!result.empty() && restoreObject(result, job)) {
+        writeDepfile(job.depfile, job.object, deps);
+        std::error_code ec;
+        std::filesystem::last_write_time(manifest, std::filesystem::file_time_type::clock::now(), ec);
+        objCacheStats.directHits++;
+        if (remote) objCacheStats.remoteHits++;
+        return true;
+    }
+
+    // preprocessed mode, -E instead of -c, into a temp file
+    std::string ppFile = job.object + ".i";
+    std::string ppCmd = preprocessCmd(job, ppFile);
+    std::string pkey;
+    TraceSpan preprocess("hash", "preprocess");
+    if (ppCmd.find(" -E ") != std::string::npos && runCommand(ppCmd + NULLIFY_CMD) == 0) {
+        pkey = sha256("pp\n" + normalizeCompileCmd(job) + sha256File(ppFile));
+    }
+    preprocess.end();
+    if (!pkey.empty()) {
+        remote = !std::exists(objCachePath("objects", pkey, ".o")) && fetchRemoteObject(pkey);
+        if (std::exists(objCachePath("objects", pkey, ".o")) && restoreObject(pkey, job)) {
+            // the preprocessor wrote the depfile for us
+            addManifestEntry(manifest, pkey, readDepfile(job.depfile));
+            uploadManifest(dkey);
+            objCacheStats.preprocessedHits++;
+            if (remote) objCacheStats.remoteHits++;
+            std::filesystem::remove(ppFile);
+            return true;
+        }
+    }
+
+    objCacheStats.misses++;
+    auto start = std::chrono::steady_clock::now();
+    // a worker compiles the preprocessed source, so it's kept until then
+    bool ok = runCompileJob(job, errFile, peakRss, pkey.empty() ? "" : ppFile);
+    std::filesystem::remove(ppFile);
+    long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    if (ok && !pkey.empty()) {
+        storeObject(pkey, job, errFile, ms);
+        addManifestEntry(manifest, pkey, readDepfile(job.depfile));
+        uploadObject(pkey);
+        uploadManifest(dkey);
+    }
+    std::filesystem::remove(errFile);
+    return ok;
+}
+
+// for the prefetch command: make sure the result for job is in the local cache if the remote has it
+// returns 0 if it was already local, 1 if it was fetched, 2 if nobody has it
+int prefetchCompile(const CompileJob& job) {
+    if (job.depfile.empty()) return 2;
+    std::string dkey = directKey(job);
+    if (!lookupManifest(objCachePath("manifests", dkey)).empty()) return 0;
+    std::vector<std::string> deps;
+    return remoteManifestLookup(dkey, deps).empty() ? 2 : 1;
+}
+
+#endif //SRC_OBJCACHE_H
@@ -0,0 +1,167 @@
+#pragma once
+#ifndef SRC_PCH_H
+#define SRC_PCH_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+
+#include "util.h"
+#include "depfile.h"
+#include "cachemgmt.h"
+
+// precompiled headers (gnu and clang, msvc is ignored)
+//     PCH target header [EXPORT]
+// the header gets a stub in target/build/pch/ that just #includes it, the stub is precompiled into stub.gch (stub.pch for clang)
+// with the target's own flags, and every c++ compile of the target gets -include stub
+// the compiler picks up the .gch/.pch next to the stub, and if it can't use it the stub still includes the real header
+// with EXPORT, dependents that have no PCH of their own use it too, straight from the exporting target
+// if their flags are compatible (see pchCompatKey), otherwise they build their own copy of it
+// bscf . pchsuggest [target(s)] looks at what the sources include (and the depfiles of the last build)
+// and lists the headers that would save the most parsing
+
+#ifdef _WIN32
+#define BSCF_NULL_STDERR " 2>NUL"
+#else
+#define BSCF_NULL_STDERR " 2>/dev/null"
+#endif
+
+std::path pchStubPath(const std::path& targetPath, const std::string& header) {
+    return targetPath / "build" / "pch" / std::path(header).filename();
+}
+
+// only written when it changes, the stub's mtime is an input of every compile
+void writePchStub(const std::path& stub, const std::string& header) {
+    std::create_directories(stub.parent_path());
+    std::string rel = std::relative(std::absolute(header), std::absolute(stub.parent_path())).generic_string();
+    std::string contents = "// generated by bscf, see PCH in proj.bscf\n#include \"" + rel + "\"\n";
+    if (!std::exists(stub) || readFile(stub) != contents) {
+        writeFileAtomic(stub, contents);
+    }
+}
+
+// two pch commands give interchangeable results if this is the same
+// gcc doesn't care about include paths when it checks a pch, only macros and codegen options, so those are dropped
+// clang checks more, so for clang it has to be the same command
+std::string pchCompatKey(const std::string& cmd, const std::string& stub, const std::string& out, bool ignoreIncludes) {
+    std::string key = replace(cmd, out, "<out>");
+    key = replace(key, stub, "<stub>");
+    if (!ignoreIncludes) return key;
+    std::stringstream ss(key);
+    std::string token;
+    std::string stripped;
+    while (ss >> token) {
+        if (token.rfind("-I", 0) == 0) continue;
+        stripped += token + " ";
+    }
+    return stripped;
+}
+
+// #include lines of one file, as written: <vector> or "foo.h"
+std::vector<std::string> scanIncludeLines(const std::path& p) {
+    std::vector<std::string> includes;
+    std::ifstream file(p);
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t i = line.find_first_not_of(" \t");
+        if (i == std::string::npos || line[i] != '#') continue;
+        i = line.find_first_not_of(" \t", i + 1);
+        if (i == std::string::npos || line.compare(i, 7, "include") != 0) continue;
+        size_t start = line.find_first_of("<\"", i + 7);
+        if (start == std::string::npos) continue;
+        size_t end = line.find(line[start] == '<' ? '>' : '"', start + 1);
+        if (end == std::string::npos) continue;
+        includes.push_back(line.substr(start, end - start + 1));
+    }
+    return includes;
+}
+
+struct PchSource {
+    std::string source;
+    std::string depfile; // empty if there isn't one
+};
+
+// bytes of preprocessed output for a file that only has this include, roughly what every source including it pays to parse
+long long preprocessedSize(const std::string& compiler, const std::string& flags, const std::string& include, const std::path& probe) {
+    writeFileAtomic(probe, "#include " + include + "\n");
+    int status = 0;
+    std::string out = runCapture(compiler + " -E -x c++ " + probe.string() + " " + flags + BSCF_NULL_STDERR, &status);
+    return status == 0 ? (long long)out.size() : -1;
+}
+
+// prints the best candidates for one target
+void suggestPch(const std::string& name, const std::vector<PchSource>& sources, const std::string& compiler, const std::string& flags,
+                const std::path& probe, size_t limit = 10) {
+    std::cout << "PCH candidates for " << name << " (" << sources.size() << " sources):" << std::endl;
+    if (sources.size() < 2) {
+        std::cout << "  fewer than 2 sources, a pch won't help" << std::endl;
+        return;
+    }
+    // how many sources pull in each header
+    // system headers (<vector>) from the sources themselves, the depfiles have them too but as every header
+    // they include in turn (absolute paths, the project's are relative to its root), which are left out,
+    // project headers from the depfiles, those include what the headers include
+    std::map<std::string, int> uses;
+    bool haveDepfiles = false;
+    for (const PchSource& s : sources) {
+        std::set<std::string> seen;
+        for (const std::string& inc : scanIncludeLines(s.source)) {
+            if (inc[0] == '<') seen.insert(inc);
+        }
+        if (!s.depfile.empty() && std::exists(s.depfile)) {
+            haveDepfiles = true;
+            for (const std::string& dep : readDepfile(s.depfile)) {
+                if (dep == s.source || dep.find("build/pch/") != std::string::npos || std::path(dep).is_absolute()) continue;
+                std::string ext = std::path(dep).extension().string();
+                if (ext == ".c" || ext == ".cpp" || ext == ".cc" || ext == ".cxx") continue;
+                seen.insert("\"" + std::absolute(dep).generic_string() + "\"");
+            }
+        }
+        for (const std::string& inc : seen) uses[inc]++;
+    }
+    struct Candidate {
+        std::string include;
+        int uses;
+        long long bytes;
+        long long saved;
+    };
+    std::vector<Candidate> candidates;
+    for (const auto& [inc, count] : uses) {
+        if (count < 2) continue;
+        long long bytes = preprocessedSize(compiler, flags, inc, probe);
+        if (bytes <= 0) continue;
+        // a pch parses it once instead of once per source
+        candidates.push_back({inc, count, bytes, (long long)(count - 1) * bytes});
+    }
+    std::filesystem::remove(probe);
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+        return a.saved > b.saved;
+    });
+    if (candidates.empty()) {
+        std::cout << "  no header is included by more than one source" << std::endl;
+    }
+    for (size_t i = 0; i < candidates.size() && i < limit; i++) {
+        const Candidate& cand = candidates[i];
+        std::string shown = cand.include;
+        if (shown[0] == '"') {
+            shown = "\"" + std::relative(shown.substr(1, shown.size() - 2)).generic_string() + "\"";
+        }
+        std::cout << "  " << std::left << std::setw(40) << shown << std::right
+                  << std::setw(4) << cand.uses << " sources " << std::setw(10) << formatSize(cand.bytes) << " each, saves ~"
+                  << formatSize(cand.saved) << " of parsing" << std::endl;
+    }
+    if (!candidates.empty()) {
+        std::cout << "  put the ones you want in a header (say src/pch.h) and add: PCH " << name << " src/pch.h" << std::endl;
+        std::cout << "  project headers that change often make poor candidates, every change rebuilds the pch and everything using it" << std::endl;
+    }
+    if (!haveDepfiles) {
+        std::cout << "  (no depfiles yet, build once to include project headers)" << std::endl;
+    }
+}
+
+#endif //SRC_PCH_H
@@ -0,0 +1,116 @@
+#pragma once
+#ifndef SRC_RECIPES_H
+#define SRC_RECIPES_H
+
+#include <string>
+#include <filesystem>
+#include <map>
+#include <fstream>
+#include <ctime>
+
+#include "util.h"
+#include "resources.h"
+
+// the recipe store keeps the proj.bscf of every builtin that uses the bscf-db in one place per user
+// so resolving a builtin is just a file read instead of cloning the db repo into every project
+// layout:
+//     ~/.bscf/recipes/
+//         index.txt // first line is the store version, then one line per recipe: name commit timestamp
+//         glfw.bscf
+//         whereami.bscf
+// the store is only refreshed when a recipe is missing, the store version changed, or the user asks for it (updaterecipes)
+
+const std::string BSCF_RECIPE_STORE_VERSION = "bscf-recipes 1";
+
+struct bscfRecipeEntry {
+    std::string commit; // commit of the db repo the recipe was taken from
+    long long fetched = 0; // unix time
+};
+
+std::path recipeStoreDir() {
+    std::path dir = bscfHomeDir() / "recipes";
+    std::create_directories(dir);
+    return dir;
+}
+
+std::map<std::string, bscfRecipeEntry> readRecipeIndex() {
+    std::map<std::string, bscfRecipeEntry> index;
+    std::ifstream file(recipeStoreDir() / "index.txt");
+    std::string line;
+    if (!std::getline(file, line) || strip(line) != BSCF_RECIPE_STORE_VERSION) {
+        // old or missing store, everything gets fetched again
+        return index;
+    }
+    while (std::getline(file, line)) {
+        std::stringstream lineStream(line);
+        std::string name;
+        bscfRecipeEntry entry;
+        if (lineStream >> name >> entry.commit >> entry.fetched) {
+            index[name] = entry;
+        }
+    }
+    return index;
+}
+
+bool writeRecipeIndex(const std::map<std::string, bscfRecipeEntry>& index) {
+    std::stringstream ss;
+    ss << BSCF_RECIPE_STORE_VERSION << std::endl;
+    for (const auto& [name, entry] : index) {
+        ss << name << " " << (entry.commit.empty() ? "unknown" : entry.commit) << " " << entry.fetched << std::endl;
+    }
+    return writeFileAtomic(recipeStoreDir() / "index.txt", ss.str());
+}
+
+// fetch the proj.bscf for name from its db repo into the store
+bool refreshRecipe(const std::string& name, const std::string& db) {
+    std::path store = recipeStoreDir();
+    std::path tmp = store / ("tmp-" + name);
+    try {
+        std::filesystem::remove_all(tmp);
+    } catch (...) {}
+    std::string cmd = "git clone --depth 1 " + db + " " + tmp.string() + NULLIFY_CMD;
+    runCommand(cmd);
+    if (!std::exists(tmp / "proj.bscf")) {
+        std::cerr << "Error: failed to fetch recipe for " << name << " from " << db << std::endl;
+        try {
+            std::filesystem::remove_all(tmp);
+        } catch (...) {}
+        return false;
+    }
+    bool ok = writeFileAtomic(store / (name + ".bscf"), readFile(tmp / "proj.bscf"));
+    bscfRecipeEntry entry;
+    entry.commit = gitHeadCommit(tmp);
+    entry.fetched = (long long)std::time(nullptr);
+    // the clone is only needed for the proj.bscf, if we can't delete it, it gets deleted next time
+    try {
+#ifdef _WIN32
+        std::string del = "del /s /f /q " + replace((tmp / ".git").string(), "/", "\\") + NULLIFY_CMD;
+        runCommand(del);
+#endif
+        std::filesystem::remove_all(tmp);
+    } catch (...) {}
+    if (!ok) {
+        std::cerr << "Error: failed to write recipe for " << name << std::endl;
+        return false;
+    }
+    std::map<std::string, bscfRecipeEntry> index = readRecipeIndex();
+    index[name] = entry;
+    writeRecipeIndex(index);
+    return true;
+}
+
+// returns the path to the stored proj.bscf for name, fetching it only if the store doesn't have it
+// returns an empty path on failure
+std::path resolveRecipe(const std::string& name, const std::string& db) {
+    std::path recipe = recipeStoreDir() / (name + ".bscf");
+    std::map<std::string, bscfRecipeEntry> index = readRecipeIndex();
+    if (std::exists(recipe) && index.find(name) != index.end()) {
+        return recipe;
+    }
+    if (!refreshRecipe(name, db)) {
+        return "";
+    }
+    return recipe;
+}
+
+#endif //SRC_RECIPES_H
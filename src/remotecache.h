@@ -0,0 +1,219 @@
+#pragma once
+#ifndef SRC_REMOTECACHE_H
+#define SRC_REMOTECACHE_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <filesystem>
+
+#include "util.h"
+#include "trace.h"
+#include "net.h"
+
+// second tier behind the local object cache, shared between machines
+// BSCF_REMOTE_CACHE is either
+//     http://host:port/prefix // GET to read, PUT to write, same layout as the local cache under prefix
+//     a directory // read only, like a cache dir on an nfs mount that ci fills
+// lookups go local first, then remote, and whatever comes from remote is copied into the local cache
+// uploads happen on a background thread so they never hold up a compile, we only wait for them at exit
+// (flushRemoteUploads, or the uploader's destructor for runs that exit some other way)
+// an http remote that can't be reached once is left alone for the rest of the run, instead of every lookup waiting on it
+// bscf . cacheserver [port] [dir] runs a small reference server on 127.0.0.1 (default port 8517, dir ~/.bscf/cache-server)
+
+const int BSCF_DEFAULT_CACHE_SERVER_PORT = 8517;
+
+std::string remoteCacheLocation() {
+    const char* env = std::getenv("BSCF_REMOTE_CACHE");
+    if (!env) return "";
+    std::string loc = env;
+    while (!loc.empty() && loc.back() == '/') loc.pop_back();
+    return loc;
+}
+
+bool remoteCacheEnabled() {
+    static bool enabled = !remoteCacheLocation().empty();
+    return enabled;
+}
+
+bool remoteIsHttp() {
+    return remoteCacheLocation().rfind("http://", 0) == 0;
+}
+
+std::atomic<bool> remoteDown{false};
+
+void markRemoteDown() {
+    if (remoteDown.exchange(true)) return;
+    std::lock_guard<std::mutex> lock(bscfOutputMutex);
+    std::cerr << "Warning: the remote cache " << remoteCacheLocation() << " can't be reached, building without it" << std::endl;
+}
+
+// rel is relative to the cache root, like objects/ab/abcd....o
+// copies the remote file into dest (atomically), false if it isn't there
+bool remoteGet(const std::string& rel, const std::path& dest) {
+    if (!remoteCacheEnabled() || remoteDown) return false;
+    TraceSpan span("fetch", rel);
+    std::string data;
+    if (remoteIsHttp()) {
+        int status = httpRequest("GET", remoteCacheLocation() + "/" + rel, "", data);
+        if (status < 0) markRemoteDown();
+        if (status != 200) return false;
+    } else {
+        std::path src = std::path(remoteCacheLocation()) / rel;
+        std::error_code ec;
+        if (!std::exists(src, ec)) return false;
+        data = readFile(src);
+    }
+    std::create_directories(dest.parent_path());
+    return writeFileAtomic(dest, data);
+}
+
+// background uploads
+struct RemoteUploader {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::pair<std::string, std::string>> queue; // rel, contents
+    std::thread worker;
+    bool stopping = false;
+    int failed = 0;
+
+    void run() {
+        while (true) {
+            std::pair<std::string, std::string> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [this] { return stopping || !queue.empty(); });
+                if (queue.empty()) return;
+                job = std::move(queue.front());
+                queue.pop_front();
+            }
+            std::string response;
+            int status = remoteDown ? -1 : httpRequest("PUT", remoteCacheLocation() + "/" + job.first, job.second, response);
+            if (status < 0) markRemoteDown();
+            if (status < 200 || status >= 300) {
+                std::lock_guard<std::mutex> lock(mutex);
+                failed++;
+            }
+        }
+    }
+
+    // waits for what's still queued, false if there was no thread
+    bool finish() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!worker.joinable()) return false;
+            stopping = true;
+        }
+        cv.notify_all();
+        worker.join();
+        return true;
+    }
+
+    // a joinable thread left at exit would end in std::terminate
+    ~RemoteUploader() {
+        finish();
+    }
+};
+
+RemoteUploader remoteUploader;
+
+// only http remotes take uploads, a shared directory is read only
+// the contents are read now, the local entry could be evicted before the upload runs
+void remotePutAsync(const std::string& rel, const std::path& src) {
+    if (!remoteCacheEnabled() || !remoteIsHttp()) return;
+    std::string data = readFile(src);
+    std::lock_guard<std::mutex> lock(remoteUploader.mutex);
+    remoteUploader.queue.emplace_back(rel, std::move(data));
+    if (!remoteUploader.worker.joinable()) {
+        remoteUploader.worker = std::thread([] { remoteUploader.run(); });
+    }
+    remoteUploader.cv.notify_one();
+}
+
+// wait for the uploads that are still queued, called once at exit
+void flushRemoteUploads() {
+    if (!remoteUploader.finish()) return;
+    if (remoteUploader.failed > 0) {
+        std::cerr << "Warning: " << remoteUploader.failed << " uploads to the remote cache failed" << std::endl;
+    }
+}
+
+// cache keys and layout only ever use these characters, anything else is someone poking around
+bool validCacheRel(const std::string& rel) {
+    if (rel.empty() || rel.find("..") != std::string::npos || rel[0] == '/') return false;
+    for (char ch : rel) {
+        if (!isalnum((unsigned char)ch) && ch != '/' && ch != '.' && ch != '_' && ch != '-') return false;
+    }
+    return true;
+}
+
+void serveCacheRequest(bscfSocket client, const std::path& dir) {
+    std::string headers;
+    std::string body;
+    std::string reply;
+    if (!netRecvHeaders(client, headers, body)) {
+        bscfCloseSocket(client);
+        return;
+    }
+    std::stringstream ss(headers);
+    std::string method;
+    std::string target;
+    ss >> method >> target;
+    std::string rel = target.size() > 1 ? target.substr(1) : "";
+    if (!validCacheRel(rel)) {
+        reply = "HTTP/1.0 400 Bad Request\r\nContent-Length: 0\r\n\r\n";
+    } else if (method == "GET") {
+        std::path p = dir / rel;
+        std::error_code ec;
+        if (std::is_regular_file(p, ec)) {
+            std::string data = readFile(p);
+            // lru, same as the local cache
+            std::filesystem::last_write_time(p, std::filesystem::file_time_type::clock::now(), ec);
+            reply = "HTTP/1.0 200 OK\r\nContent-Length: " + std::to_string(data.size()) + "\r\n\r\n" + data;
+        } else {
+            reply = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+        }
+    } else if (method == "PUT") {
+        long long len = httpContentLength(headers);
+        if (len < 0 || !netRecvExact(client, body, (size_t)len)) {
+            reply = "HTTP/1.0 400 Bad Request\r\nContent-Length: 0\r\n\r\n";
+        } else {
+            body.resize((size_t)len);
+            std::path p = dir / rel;
+            std::create_directories(p.parent_path());
+            if (writeFileAtomic(p, body)) {
+                reply = "HTTP/1.0 201 Created\r\nContent-Length: 0\r\n\r\n";
+            } else {
+                reply = "HTTP/1.0 500 Internal Server Error\r\nContent-Length: 0\r\n\r\n";
+            }
+        }
+    } else {
+        reply = "HTTP/1.0 405 Method Not Allowed\r\nContent-Length: 0\r\n\r\n";
+    }
+    netSendAll(client, reply);
+    bscfCloseSocket(client);
+}
+
+// runs until killed
+int runCacheServer(int port, const std::path& dir) {
+    std::create_directories(dir);
+    bscfSocket server = netListenLocal(port);
+    if (server == BSCF_BAD_SOCKET) {
+        std::cerr << "Error: could not listen on 127.0.0.1:" << port << std::endl;
+        return 1;
+    }
+    std::cout << "Serving " << dir.string() << " on http://127.0.0.1:" << port << std::endl;
+    std::cout << "Use it with BSCF_REMOTE_CACHE=http://127.0.0.1:" << port << std::endl;
+    while (true) {
+        bscfSocket client = accept(server, nullptr, nullptr);
+        if (client == BSCF_BAD_SOCKET) continue;
+        setSocketTimeout(client, 30);
+        std::thread(serveCacheRequest, client, dir).detach();
+    }
+}
+
+#endif //SRC_REMOTECACHE_H
@@ -0,0 +1,187 @@
+#pragma once
+#ifndef SRC_RESOURCES_H
+#define SRC_RESOURCES_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <cerrno>
+
+#ifndef _WIN32
+#include <spawn.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+extern char** environ;
+#endif
+
+#include "util.h"
+
+// what the machine has left, so the scheduler doesn't start more than fits (see Scheduler::admit)
+//     memory: MemAvailable from /proc/meminfo, or what's left under the cgroup v2 limit if that's less:
+//         memory.max - (memory.current - inactive_file from memory.stat), page cache that can be dropped isn't used up,
+//         for bscf's cgroup and every one above it (a container's limit is often on a parent)
+//     load: processes that want a cpu right now and aren't ours (the runnable count in /proc/loadavg, which
+//         unlike the averages next to it doesn't lag a minute behind our own jobs starting and finishing)
+// and what an action needs: its peak RSS, from wait4 when it ran last time (rss in the build state)
+// linux only, elsewhere these return -1 and the scheduler just uses the job count
+
+// a guess for actions that never ran (or only ever came from the cache)
+const long long BSCF_UNKNOWN_JOB_MEMORY = 256LL * 1024 * 1024;
+// fraction of the available memory jobs may take, the rest is for the page cache and everything else
+const double BSCF_MEMORY_HEADROOM = 0.9;
+
+// bytes, -1 if unknown
+long long readMemoryValue(const std::string& file) {
+    std::ifstream f(file);
+    std::string value;
+    if (!(f >> value) || value == "max") return -1;
+    try {
+        return std::stoll(value);
+    } catch (...) {
+        return -1;
+    }
+}
+
+// a field of a cgroup's memory.stat (bytes), -1 if it's not there
+long long readMemoryStat(const std::string& file, const std::string& key) {
+    std::ifstream f(file);
+    std::string name;
+    long long value;
+    while (f >> name >> value) {
+        if (name == key) return value;
+    }
+    return -1;
+}
+
+// bytes of memory new processes can use, -1 if unknown
+long long availableMemory() {
+#ifdef __linux__
+    long long available = -1;
+    std::ifstream meminfo("/proc/meminfo");
+    std::string line;
+    while (std::getline(meminfo, line)) {
+        if (line.rfind("MemAvailable:", 0) == 0) {
+            std::stringstream ss(line.substr(13));
+            long long kb = 0;
+            if (ss >> kb) available = kb * 1024;
+            break;
+        }
+    }
+    // cgroup v2: the line "0::/path" in /proc/self/cgroup
+    std::ifstream cgroup("/proc/self/cgroup");
+    while (std::getline(cgroup, line)) {
+        if (line.rfind("0::", 0) != 0) continue;
+        // from ours up to the root
+        std::string rel = line.substr(3);
+        while (true) {
+            std::string dir = "/sys/fs/cgroup" + rel;
+            long long max = readMemoryValue(dir + "/memory.max");
+            long long current = readMemoryValue(dir + "/memory.current");
+            if (max >= 0 && current >= 0) {
+                long long inactive = readMemoryStat(dir + "/memory.stat", "inactive_file");
+                if (inactive > 0 && inactive < current) current -= inactive;
+                long long left = max > current ? max - current : 0;
+                if (available < 0 || left < available) available = left;
+            }
+            if (rel.empty() || rel == "/") break;
+            rel = rel.substr(0, rel.find_last_of('/'));
+        }
+    }
+    return available;
+#else
+    return -1;
+#endif
+}
+
+// processes wanting a cpu right now, bscf itself included, -1 if unknown
+int runnableProcesses() {
+#ifdef __linux__
+    std::ifstream loadavg("/proc/loadavg");
+    std::string one, five, fifteen, procs;
+    if (!(loadavg >> one >> five >> fifteen >> procs)) return -1;
+    try {
+        return std::stoi(procs.substr(0, procs.find('/')));
+    } catch (...) {
+        return -1;
+    }
+#else
+    return -1;
+#endif
+}
+
+// like system(), but also says how much memory the command took at most (bytes, -1 if unknown)
+// the rusage covers the shell and everything it waited for, so that's the biggest process of the command
+int runCommand(const std::string& cmd, long long* peakRss = nullptr) {
+    BSCF_STAT_TIME(Stat::SPAWNS);
+    BSCF_STAT_ADD(Stat::SPAWNS, 1);
+    if (peakRss) *peakRss = -1;
+#ifdef _WIN32
+    return system(cmd.c_str());
+#else
+    const char* argv[] = {"sh", "-c", cmd.c_str(), nullptr};
+    pid_t pid;
+    if (posix_spawn(&pid, "/bin/sh", nullptr, nullptr, (char* const*)argv, environ) != 0) return -1;
+    int status = 0;
+    struct rusage usage {};
+    while (wait4(pid, &status, 0, &usage) < 0) {
+        if (errno != EINTR) return -1;
+    }
+#ifdef __APPLE__
+    if (peakRss) *peakRss = (long long)usage.ru_maxrss; // bytes
+#else
+    if (peakRss) *peakRss = (long long)usage.ru_maxrss * 1024; // kilobytes
+#endif
+    return status;
+#endif
+}
+
+// what the command exited with, from the status runCommand returns (128 + the signal if one killed it, like a shell says)
+int exitCode(int status) {
+#ifdef _WIN32
+    return status;
+#else
+    if (status < 0) return -1;
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    return WEXITSTATUS(status);
+#endif
+}
+
+// args[0] is run directly (found in PATH, no shell in between), stderr goes to errFile
+int runArgs(const std::vector<std::string>& args, const std::string& errFile, long long* peakRss = nullptr) {
+    BSCF_STAT_TIME(Stat::SPAWNS);
+    BSCF_STAT_ADD(Stat::SPAWNS, 1);
+    if (peakRss) *peakRss = -1;
+#ifdef _WIN32
+    std::string cmd;
+    for (const std::string& a : args) cmd += (cmd.empty() ? "" : " ") + a;
+    return system((cmd + " 2> " + errFile).c_str());
+#else
+    std::vector<char*> argv;
+    for (const std::string& a : args) argv.push_back((char*)a.c_str());
+    argv.push_back(nullptr);
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 2, errFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    pid_t pid;
+    int err = posix_spawnp(&pid, argv[0], &actions, nullptr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (err != 0) return -1;
+    int status = 0;
+    struct rusage usage {};
+    while (wait4(pid, &status, 0, &usage) < 0) {
+        if (errno != EINTR) return -1;
+    }
+#ifdef __APPLE__
+    if (peakRss) *peakRss = (long long)usage.ru_maxrss;
+#else
+    if (peakRss) *peakRss = (long long)usage.ru_maxrss * 1024;
+#endif
+    return status;
+#endif
+}
+
+#endif //SRC_RESOURCES_H
@@ -0,0 +1,202 @@
+#pragma once
+#ifndef SRC_SCANNER_H
+#define SRC_SCANNER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <cstring>
+#include <filesystem>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "util.h"
+#include "trace.h"
+
+// a quick #include scanner, for a header graph before anything was compiled (depfiles only exist after the first build)
+// sources are mmapped and searched for '#' with memchr (which libc vectorizes), only lines starting with # include are looked at
+// includes are resolved like the compiler would for the project's own headers: "x.h" next to the including file first,
+// then the target's include dirs (bscfResolveIncludes), anything not found there is a system header and left out (like -MMD does)
+// it's approximate: #if is ignored (so it can only find more than the compiler, never less)
+// and an #include of a macro can't be followed, those files are marked computed
+// used for
+//     msvc compiles, which write no depfile: their inputs are the headers the scanner finds instead of every header of the target
+//     bscf . affected header: which sources (of which targets) include a header
+//     guessing what a compile costs before it ever ran, and balancing unity batches (closureBytes)
+//     bscf . scanbench [target(s)]: the scanner against gcc -MM, time and how well the header lists agree
+
+// read only view of a whole file, mmapped where we can
+class MappedFile {
+public:
+    explicit MappedFile(const std::path& p) {
+#ifndef _WIN32
+        fd = open(p.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) return;
+        void* m = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m == MAP_FAILED) return;
+        mapped = m;
+        bytes = (size_t)st.st_size;
+        ptr = (const char*)m;
+#else
+        contents = readFile(p);
+        ptr = contents.data();
+        bytes = contents.size();
+#endif
+    }
+    ~MappedFile() {
+#ifndef _WIN32
+        if (mapped) munmap(mapped, bytes);
+        if (fd >= 0) close(fd);
+#endif
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return ptr; }
+    size_t size() const { return bytes; }
+
+private:
+    const char* ptr = nullptr;
+    size_t bytes = 0;
+#ifndef _WIN32
+    int fd = -1;
+    void* mapped = nullptr;
+#else
+    std::string contents;
+#endif
+};
+
+struct IncludeDirective {
+    std::string name;
+    bool angled; // <x.h> rather than "x.h"
+};
+
+// every # include in the buffer, computed is set if one of them names a macro
+std::vector<IncludeDirective> scanIncludeDirectives(const char* data, size_t size, bool& computed) {
+    std::vector<IncludeDirective> includes;
+    const char* end = data + size;
+    const char* p = data;
+    while (p < end && (p = (const char*)memchr(p, '#', (size_t)(end - p)))) {
+        const char* hash = p++;
+        // only whitespace between the start of the line and the #
+        const char* q = hash;
+        while (q > data && (q[-1] == ' ' || q[-1] == '\t')) q--;
+        if (q > data && q[-1] != '\n') continue;
+        while (p < end && (*p == ' ' || *p == '\t')) p++;
+        if (end - p < 7 || memcmp(p, "include", 7) != 0) continue;
+        p += 7;
+        while (p < end && (*p == ' ' || *p == '\t')) p++;
+        if (p >= end) break;
+        if (*p != '<' && *p != '"') {
+            // #include_next is the compiler's business, #include MACRO can't be followed
+            if (p[-1] == ' ' || p[-1] == '\t') computed = true;
+            continue;
+        }
+        char close = *p == '<' ? '>' : '"';
+        const char* lineEnd = (const char*)memchr(p, '\n', (size_t)(end - p));
+        if (!lineEnd) lineEnd = end;
+        const char* nameEnd = (const char*)memchr(p + 1, close, (size_t)(lineEnd - p - 1));
+        if (!nameEnd) continue;
+        includes.push_back({std::string(p + 1, nameEnd), close == '>'});
+        p = nameEnd;
+    }
+    return includes;
+}
+
+class IncludeScanner {
+public:
+    explicit IncludeScanner(const std::vector<std::string>& searchPath) : searchPath(searchPath) {}
+
+    // project headers file includes directly
+    const std::vector<std::string>& direct(const std::string& file) {
+        auto it = files.find(file);
+        if (it != files.end()) return it->second.headers;
+        BSCF_STAT_TIME(Stat::LEXER);
+        BSCF_STAT_ADD(Stat::LEXER, 1);
+        ScannedFile& scanned = files[file];
+        MappedFile mapped(file);
+        std::vector<IncludeDirective> includes = scanIncludeDirectives(mapped.data(), mapped.size(), scanned.computed);
+        std::string dir = std::path(file).parent_path().string();
+        for (const IncludeDirective& inc : includes) {
+            std::string resolved = resolve(inc, dir);
+            if (!resolved.empty()) scanned.headers.push_back(resolved);
+        }
+        bytesScanned += (long long)mapped.size();
+        return scanned.headers;
+    }
+
+    // every project header source ends up including, sorted
+    // computed is set if any file on the way has an include the scanner can't follow
+    std::vector<std::string> closure(const std::string& source, bool* computed = nullptr) {
+        TraceSpan span("scan", source);
+        std::set<std::string> seen;
+        std::vector<std::string> stack{normalize(source)};
+        while (!stack.empty()) {
+            std::string file = stack.back();
+            stack.pop_back();
+            for (const std::string& header : direct(file)) {
+                if (seen.insert(header).second) stack.push_back(header);
+            }
+            if (computed && files[file].computed) *computed = true;
+        }
+        return {seen.begin(), seen.end()};
+    }
+
+    // bytes of source and of every project header it includes, roughly what the compiler has to get through
+    long long closureBytes(const std::string& source) {
+        std::error_code ec;
+        long long bytes = (long long)std::filesystem::file_size(source, ec);
+        if (ec) bytes = 0;
+        for (const std::string& header : closure(source)) {
+            long long size = (long long)std::filesystem::file_size(header, ec);
+            if (!ec) bytes += size;
+        }
+        return bytes;
+    }
+
+    long long bytesScanned = 0;
+
+private:
+    struct ScannedFile {
+        std::vector<std::string> headers;
+        bool computed = false;
+    };
+
+    std::vector<std::string> searchPath;
+    std::map<std::string, ScannedFile> files;
+    std::map<std::string, std::string> resolved; // dir + include -> file, "" if it isn't a project header
+
+    static std::string normalize(const std::string& p) {
+        return std::path(p).lexically_normal().string();
+    }
+
+    std::string resolve(const IncludeDirective& inc, const std::string& dir) {
+        std::string key = (inc.angled ? "<" : dir + "\"") + inc.name;
+        auto it = resolved.find(key);
+        if (it != resolved.end()) return it->second;
+        std::string found;
+        std::error_code ec;
+        if (!inc.angled) BSCF_STAT_ADD(Stat::FILE_STATS, 1);
+        if (!inc.angled && std::filesystem::is_regular_file(std::path(dir) / inc.name, ec)) {
+            found = normalize((std::path(dir) / inc.name).string());
+        }
+        for (size_t i = 0; found.empty() && i < searchPath.size(); i++) {
+            BSCF_STAT_ADD(Stat::FILE_STATS, 1);
+            if (std::filesystem::is_regular_file(std::path(searchPath[i]) / inc.name, ec)) {
+                found = normalize((std::path(searchPath[i]) / inc.name).string());
+            }
+        }
+        resolved[key] = found;
+        return found;
+    }
+};
+
+#endif //SRC_SCANNER_H
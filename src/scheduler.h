@@ -0,0 +1,352 @@
+#pragma once
+#ifndef SRC_SCHEDULER_H
+#define SRC_SCHEDULER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <set>
+#include <tuple>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+
+#include "resources.h"
+#include "jobserver.h"
+#include "trace.h"
+
+// runs a graph of jobs on up to N threads, a job starts once every job it depends on succeeded
+// if a job fails, nothing depending on it runs (everything else still does, like make -k)
+// light jobs are bookkeeping (no commands), they run right away on the scheduling thread and don't take a slot
+// every job has a cost (expected ms), and of the ready jobs the one with the longest path to the end of the build goes first
+// (critical path first, ties go to the longer job, then to the one added first), so long chains and big compiles don't end up last
+// afterwards printCriticalPath shows the chain that actually took the longest, and how far the build was from the best it could do
+// the job count is only the most that run at once, a job also has to fit (see admit): the memory it's expected to take
+// has to fit in what's available, and processes of others wanting the cpus take slots away
+// if the best job doesn't fit, a smaller one that does goes first, and if nothing fits it's checked again a little later
+// one job always runs, however big, so the build can't get stuck
+// jobs waiting on each other in a circle never run, run refuses such a graph up front
+// past the first job, every job holds a token of the make jobserver (see jobserver.h), bscf's own or the one of the make running it
+// pools cap how many of the jobs in them run at once, without holding up the rest: while a pool is full its other jobs
+// wait and the free slots go to whatever else is ready
+//     POOL link 2 // at most 2 links at once, links are in the link pool unless USEPOOL puts them elsewhere (undeclared it has no limit)
+//     POOL gen 1
+//     USEPOOL target gen [PREBUILD/PCH/COMPILE/ARCHIVE/LINK/COPY/POSTBUILD] // its actions of that kind, or all of them
+
+// what actions that never ran are guessed to cost (ms), see bscfBuilder::estimateActionMs
+const long long BSCF_COMPILE_MS = 200;
+const long long BSCF_COMPILE_MS_PER_KB = 4; // of the source and the project headers it includes
+const long long BSCF_LINK_MS = 300;
+const long long BSCF_ARCHIVE_MS = 50;
+const long long BSCF_COPY_MS = 10;
+const long long BSCF_STEP_MS = 100; // prebuild and postbuild
+
+// -j past this is taken as this, every job is a thread (and a token in the jobserver's pipe)
+const size_t BSCF_MAX_JOBS = 1024;
+
+// -j default
+size_t defaultJobCount() {
+    size_t n = std::thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
+
+class Scheduler {
+public:
+    // returns the id of the job, for depend
+    size_t add(std::function<bool()> run, bool light = false, long long cost = 0, const std::string& label = "", long long memory = 0) {
+        Job j;
+        j.run = std::move(run);
+        j.light = light;
+        j.cost = cost;
+        j.label = label;
+        j.memory = memory;
+        jobs.push_back(std::move(j));
+        return jobs.size() - 1;
+    }
+
+    // returns the id of the pool, for setPool
+    size_t addPool(size_t depth) {
+        pools.push_back({depth, 0});
+        return pools.size() - 1;
+    }
+
+    void addToPool(size_t job, size_t pool) {
+        jobs[job].pools.push_back(pool);
+    }
+
+    // job waits for on
+    void depend(size_t job, size_t on) {
+        if (job == on) return;
+        jobs[on].dependents.push_back(job);
+        jobs[job].waiting++;
+    }
+
+    // false if any job failed (or didn't run because something it needs failed)
+    bool run(size_t threads) {
+        if (threads < 1) threads = 1;
+        this->threads = threads;
+        if (!sortJobs()) {
+            std::cerr << "Error: the jobs depend on each other in a cycle" << std::endl;
+            return false;
+        }
+        // from the end of the build back
+        for (auto it = order.rbegin(); it != order.rend(); ++it) {
+            Job& j = jobs[*it];
+            long long longest = 0;
+            for (size_t dep : j.dependents) longest = std::max(longest, jobs[dep].path);
+            j.path = j.cost + longest;
+        }
+        // longest path first, then longest job, then first added
+        std::set<std::tuple<long long, long long, size_t>> ready;
+        std::deque<size_t> readyLight;
+        auto makeReady = [&](size_t id) {
+            if (jobs[id].light) readyLight.push_back(id);
+            else ready.insert({-jobs[id].path, -jobs[id].cost, id});
+        };
+        for (size_t i = 0; i < jobs.size(); i++) {
+            if (jobs[i].waiting == 0) makeReady(i);
+        }
+        start = std::chrono::steady_clock::now();
+        memoryAtStart = availableMemory();
+        // for the commands the workers run too, it's in their MAKEFLAGS
+        Jobserver jobserver(threads);
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < threads; i++) {
+            workers.emplace_back([this, i] {
+                traceThreadName("lane " + std::to_string(i + 1));
+                work();
+            });
+        }
+        size_t remaining = jobs.size();
+        size_t running = 0;
+        bool ok = true;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (remaining > 0) {
+            // start what we can
+            while (!readyLight.empty()) {
+                size_t id = readyLight.front();
+                readyLight.pop_front();
+                lock.unlock();
+                bool good = timed(id);
+                lock.lock();
+                done.push_back({id, good});
+            }
+            bool heldBack = false;
+            while (!ready.empty() && running < threads) {
+                auto it = ready.begin();
+                Resources now = measure(running);
+                while (it != ready.end() && !admit(jobs[std::get<2>(*it)], now, running)) ++it;
+                if (it == ready.end()) {
+                    heldBack = true;
+                    break;
+                }
+                if (running > 0 && !jobserver.tryAcquire()) {
+                    heldBack = true;
+                    break;
+                }
+                size_t id = std::get<2>(*it);
+                ready.erase(it);
+                queue.push_back(id);
+                running++;
+                committed += jobs[id].memory;
+                for (size_t pool : jobs[id].pools) pools[pool].running++;
+                workAvailable.notify_one();
+            }
+            if (done.empty()) {
+                // memory frees up and other processes finish without telling us
+                if (heldBack) jobDone.wait_for(lock, std::chrono::milliseconds(200), [this] { return !done.empty(); });
+                else jobDone.wait(lock, [this] { return !done.empty(); });
+            }
+            while (!done.empty()) {
+                auto [id, good] = done.front();
+                done.pop_front();
+                if (!jobs[id].light) {
+                    running--;
+                    committed -= jobs[id].memory;
+                    for (size_t pool : jobs[id].pools) pools[pool].running--;
+                    // the job that runs for free is the last one left
+                    while (jobserver.tokens() > 0 && jobserver.tokens() + 1 > running) jobserver.release();
+                }
+                remaining--;
+                if (!good) {
+                    ok = false;
+                    remaining -= cancel(id);
+                    continue;
+                }
+                for (size_t dep : jobs[id].dependents) {
+                    if (--jobs[dep].waiting == 0 && !jobs[dep].cancelled) makeReady(dep);
+                }
+            }
+        }
+        stopping = true;
+        workAvailable.notify_all();
+        lock.unlock();
+        for (std::thread& w : workers) w.join();
+        wallMs = ms(start, std::chrono::steady_clock::now());
+        return ok;
+    }
+
+    // the chain of jobs that took the longest (by how long they actually took), against the wall time
+    void printCriticalPath(std::ostream& out, size_t limit = 20) {
+        if (jobs.empty() || order.size() != jobs.size()) return;
+        std::vector<long long> best(jobs.size(), 0); // longest actual chain starting at the job
+        std::vector<size_t> next(jobs.size(), (size_t)-1);
+        long long work = 0;
+        for (auto it = order.rbegin(); it != order.rend(); ++it) {
+            size_t id = *it;
+            long long longest = 0;
+            for (size_t dep : jobs[id].dependents) {
+                if (jobs[dep].ran && best[dep] > longest) {
+                    longest = best[dep];
+                    next[id] = dep;
+                }
+            }
+            best[id] = (jobs[id].ran ? jobs[id].took : 0) + longest;
+            if (jobs[id].ran) work += jobs[id].took;
+        }
+        size_t first = 0;
+        for (size_t i = 0; i < jobs.size(); i++) {
+            if (best[i] > best[first]) first = i;
+        }
+        std::vector<size_t> chain;
+        for (size_t i = first; i != (size_t)-1; i = next[i]) {
+            if (jobs[i].ran && !jobs[i].label.empty()) chain.push_back(i);
+        }
+        long long critical = best[first];
+        long long bound = std::max(critical, work / (long long)threads);
+        out << "critical path: " << critical << " ms, " << chain.size() << " actions" << std::endl;
+        for (size_t k = 0; k < chain.size() && k < limit; k++) {
+            const Job& j = jobs[chain[k]];
+            out << "  " << std::setw(8) << j.took << " ms  " << j.label;
+            if (j.cost > 0) out << " (expected " << j.cost << " ms)";
+            out << std::endl;
+        }
+        if (chain.size() > limit) out << "  ... " << chain.size() - limit << " more" << std::endl;
+        out << "wall time " << wallMs << " ms, at best " << bound << " ms (critical path " << critical << " ms, "
+            << work << " ms of work over " << threads << " jobs)" << std::endl;
+    }
+
+private:
+    struct Job {
+        std::function<bool()> run;
+        bool light = false;
+        long long cost = 0; // expected ms
+        std::string label; // for printCriticalPath, empty for milestones
+        long long path = 0; // cost of the longest chain from here to the end
+        size_t waiting = 0; // jobs it still waits for
+        bool cancelled = false;
+        bool ran = false;
+        long long took = 0; // ms
+        long long memory = 0; // expected peak, bytes
+        std::vector<size_t> pools;
+        std::vector<size_t> dependents;
+    };
+
+    struct Pool {
+        size_t depth;
+        size_t running;
+    };
+
+    std::vector<Job> jobs;
+    std::vector<size_t> order; // every job after all it waits for, see sortJobs
+    std::vector<Pool> pools;
+    std::mutex mutex;
+    std::condition_variable workAvailable;
+    std::condition_variable jobDone;
+    std::deque<size_t> queue; // for the workers
+    std::deque<std::pair<size_t, bool>> done; // finished jobs and whether they succeeded
+    bool stopping = false;
+    std::chrono::steady_clock::time_point start;
+    long long wallMs = 0;
+    size_t threads = 1;
+    long long memoryAtStart = -1;
+    long long committed = 0; // memory the running jobs are expected to take
+
+    struct Resources {
+        long long memory = -1; // what jobs may still take, -1 if unknown
+        int otherLoad = 0; // processes wanting a cpu that aren't ours
+    };
+
+    Resources measure(size_t running) {
+        Resources r;
+        long long available = availableMemory();
+        if (available >= 0 && memoryAtStart >= 0) {
+            // jobs that just started haven't grown yet, ones that ran a while already took theirs out of available
+            long long limit = std::min(memoryAtStart, available + committed);
+            r.memory = (long long)((double)limit * BSCF_MEMORY_HEADROOM) - committed;
+        }
+        // minus bscf itself and the compilers it runs (roughly, a job can be waiting on the disk instead)
+        int runnable = runnableProcesses();
+        if (runnable >= 0) r.otherLoad = std::max(0, runnable - 1 - (int)running);
+        return r;
+    }
+
+    bool admit(const Job& j, const Resources& r, size_t running) {
+        for (size_t pool : j.pools) {
+            if (pools[pool].running >= pools[pool].depth) return false;
+        }
+        if (running == 0) return true;
+        if (r.memory >= 0 && j.memory > r.memory) return false;
+        return running + (size_t)r.otherLoad < std::max(threads, defaultJobCount());
+    }
+
+    static long long ms(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to) {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(to - from).count();
+    }
+
+    bool timed(size_t id) {
+        auto begin = std::chrono::steady_clock::now();
+        bool good = jobs[id].run();
+        jobs[id].took = ms(begin, std::chrono::steady_clock::now());
+        jobs[id].ran = true;
+        return good;
+    }
+
+    // fills order (kahn's algorithm, so deep graphs don't recurse), false if some jobs wait on each other in a cycle
+    bool sortJobs() {
+        order.clear();
+        std::vector<size_t> waiting(jobs.size());
+        for (size_t i = 0; i < jobs.size(); i++) {
+            waiting[i] = jobs[i].waiting;
+            if (waiting[i] == 0) order.push_back(i);
+        }
+        for (size_t k = 0; k < order.size(); k++) {
+            for (size_t dep : jobs[order[k]].dependents) {
+                if (--waiting[dep] == 0) order.push_back(dep);
+            }
+        }
+        return order.size() == jobs.size();
+    }
+
+    void work() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            workAvailable.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (queue.empty()) return;
+            size_t id = queue.front();
+            queue.pop_front();
+            lock.unlock();
+            bool good = timed(id);
+            lock.lock();
+            done.push_back({id, good});
+            jobDone.notify_one();
+        }
+    }
+
+    // everything after a failed job, returns how many were cancelled
+    size_t cancel(size_t id) {
+        size_t count = 0;
+        for (size_t dep : jobs[id].dependents) {
+            if (jobs[dep].cancelled) continue;
+            jobs[dep].cancelled = true;
+            count += 1 + cancel(dep);
+        }
+        return count;
+    }
+};
+
+#endif //SRC_SCHEDULER_H
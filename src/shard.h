@@ -0,0 +1,56 @@
+#pragma once
+#ifndef SRC_SHARD_H
+#define SRC_SHARD_H
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <numeric>
+
+// splitting one build over several machines (ci runners), each compiling a part into a shared cache
+//     bscf . build --shard K/N // on runner K of N, with the same BSCF_CACHE_DIR (a shared mount) or BSCF_REMOTE_CACHE
+//     bscf . build // afterwards, on any of them: every compile is a cache hit, this only links
+// the compiles are spread over the shards by cost (the guess from the size of the source and its headers, not the ms
+// in the build state, that's only what this runner saw), largest first onto the shard with the least so far,
+// ties broken by the object path, so every runner works out the same split as long as they start from the same checkout
+// a shard also runs what its compiles need: every prebuild step, and the pch or module interfaces they use
+// (those may run on several shards, they're cached too), archives, links, copies and postbuild steps wait for the merge
+// a compile no shard picked (a runner that saw other costs) isn't lost, the merge compiles it
+
+bool parseShard(const std::string& s, size_t& k, size_t& n) {
+    size_t slash = s.find('/');
+    if (slash == std::string::npos || slash == 0 || slash + 1 == s.size()) return false;
+    std::string a = s.substr(0, slash);
+    std::string b = s.substr(slash + 1);
+    if (a.find_first_not_of("0123456789") != std::string::npos || b.find_first_not_of("0123456789") != std::string::npos) return false;
+    try {
+        k = std::stoul(a);
+        n = std::stoul(b);
+    } catch (...) {
+        return false;
+    }
+    return n > 0 && k >= 1 && k <= n;
+}
+
+// the shard (0 based) of every unit, units are (cost, name) and the name makes it deterministic
+std::vector<size_t> planShards(const std::vector<std::pair<long long, std::string>>& units, size_t shards) {
+    std::vector<size_t> order(units.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        if (units[a].first != units[b].first) return units[a].first > units[b].first;
+        return units[a].second < units[b].second;
+    });
+    std::vector<long long> load(shards, 0);
+    std::vector<size_t> shardOf(units.size(), 0);
+    for (size_t u : order) {
+        size_t best = 0;
+        for (size_t s = 1; s < shards; s++) {
+            if (load[s] < load[best]) best = s;
+        }
+        shardOf[u] = best;
+        load[best] += units[u].first;
+    }
+    return shardOf;
+}
+
+#endif //SRC_SHARD_H
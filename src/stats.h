@@ -0,0 +1,127 @@
+#pragma once
+#ifndef SRC_STATS_H
+#define SRC_STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstddef>
+
+// -d stats: what bscf itself spent its time on, printed when it exits, to tell what makes a no-op build slow
+//     bscf . -d stats build
+// for each of its hot paths how often it ran and how long it took:
+//     proj.bscf reads, regex passes (over proj.bscf and the like), lexer passes (the include and module scanners),
+//     directory entries scanned (recurseDir), files stat'd (input stamps), bytes hashed (sha256), cache lookups
+//     (manifests and objects, local or remote), commands spawned and the time waiting for them
+// the counters only exist in builds with BSCF_STATS defined (the cmake option of the same name, on by default),
+// without it BSCF_STAT_ADD and BSCF_STAT_TIME are nothing and -d stats says so
+// with it but without -d stats, a counter is a branch
+// a timer inside another of the same kind on the same thread (recurseDir calling itself) doesn't count twice,
+// but the times of different kinds overlap where one calls the other (a cache lookup hashes the files in the manifest)
+
+enum class Stat {
+    PROJ_READS,
+    REGEX,
+    LEXER,
+    DIR_ENTRIES,
+    FILE_STATS,
+    BYTES_HASHED,
+    CACHE_LOOKUPS,
+    SPAWNS,
+    COUNT
+};
+
+const char* statName(Stat s) {
+    switch (s) {
+        case Stat::PROJ_READS: return "proj.bscf reads";
+        case Stat::REGEX: return "regex passes";
+        case Stat::LEXER: return "lexer passes";
+        case Stat::DIR_ENTRIES: return "dir entries scanned";
+        case Stat::FILE_STATS: return "files stat'd";
+        case Stat::BYTES_HASHED: return "bytes hashed";
+        case Stat::CACHE_LOOKUPS: return "cache lookups";
+        case Stat::SPAWNS: return "commands spawned";
+        default: return "";
+    }
+}
+
+struct StatCounter {
+    std::atomic<long long> count{0}; // things (entries, bytes, ...), see BSCF_STAT_ADD
+    std::atomic<long long> calls{0}; // timed calls, see BSCF_STAT_TIME
+    std::atomic<long long> ns{0};
+};
+
+bool bscfStatsEnabled = false;
+StatCounter bscfStats[(size_t)Stat::COUNT];
+
+#ifdef BSCF_STATS
+
+class StatTimer {
+public:
+    explicit StatTimer(Stat s) : stat(s) {
+        if (!bscfStatsEnabled || nested()[(size_t)s]) return;
+        active = true;
+        nested()[(size_t)s] = true;
+        start = std::chrono::steady_clock::now();
+    }
+
+    ~StatTimer() {
+        if (!active) return;
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        bscfStats[(size_t)stat].calls++;
+        bscfStats[(size_t)stat].ns += ns;
+        nested()[(size_t)stat] = false;
+    }
+
+    StatTimer(const StatTimer&) = delete;
+    StatTimer& operator=(const StatTimer&) = delete;
+
+private:
+    Stat stat;
+    bool active = false;
+    std::chrono::steady_clock::time_point start;
+
+    static bool* nested() {
+        thread_local bool running[(size_t)Stat::COUNT] = {};
+        return running;
+    }
+};
+
+#define BSCF_STAT_CONCAT2(a, b) a##b
+#define BSCF_STAT_CONCAT(a, b) BSCF_STAT_CONCAT2(a, b)
+#define BSCF_STAT_ADD(stat, n) do { if (bscfStatsEnabled) bscfStats[(size_t)(stat)].count += (n); } while (0)
+#define BSCF_STAT_TIME(stat) StatTimer BSCF_STAT_CONCAT(statTimer, __LINE__)(stat)
+const bool bscfStatsCompiled = true;
+
+#else
+
+#define BSCF_STAT_ADD(stat, n) do {} while (0)
+#define BSCF_STAT_TIME(stat) do {} while (0)
+const bool bscfStatsCompiled = false;
+
+#endif
+
+void printStats() {
+    if (!bscfStatsEnabled) return;
+    std::printf("bscf stats:\n");
+    std::printf("  %-22s %12s %10s %12s %10s\n", "", "count", "calls", "total ms", "avg us");
+    for (size_t i = 0; i < (size_t)Stat::COUNT; i++) {
+        const StatCounter& c = bscfStats[i];
+        long long calls = c.calls;
+        long long ns = c.ns;
+        std::printf("  %-22s %12lld %10lld %12.1f %10.1f\n", statName((Stat)i), (long long)c.count, calls, (double)ns / 1e6,
+                    calls > 0 ? (double)ns / 1e3 / (double)calls : 0.0);
+    }
+    std::fflush(stdout);
+}
+
+// from here on everything is counted, and printed when bscf exits, false if this build can't count
+bool startStats() {
+    if (!bscfStatsCompiled) return false;
+    if (!bscfStatsEnabled) std::atexit(printStats);
+    bscfStatsEnabled = true;
+    return true;
+}
+
+#endif //SRC_STATS_H
@@ -0,0 +1,214 @@
+#pragma once
+#ifndef SRC_TOOLCHAIN_H
+#define SRC_TOOLCHAIN_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <filesystem>
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+#include "util.h"
+#include "hash.h"
+
+// finding the compiler used to mean running gcc --version (then clang, then cl) through system() on every start
+// and git --version for every GITINCLUDE/BUILTIN line
+// now the tools are looked up in PATH ourselves, and the probe results are kept in ~/.bscf/toolchain.cache
+// the cache key is PATH plus the path, size, mtime and inode of every tool we found,
+// so the tools are only run again when one of them is installed, removed, upgraded or PATH changes
+
+const std::string BSCF_TOOLCHAIN_CACHE_VERSION = "bscf-toolchain 1";
+
+// every tool we care about, in no particular order
+const std::vector<std::string> BSCF_TOOLS = {"gcc", "g++", "clang", "clang++", "cl", "link", "lib", "ar", "git"};
+
+struct ToolInfo {
+    std::string path; // empty if not found
+    std::string stamp; // size/mtime/inode of the real file, part of the cache key
+    std::string version; // first line of the version output, empty if the probe failed
+    bool available = false;
+};
+
+struct Toolchain {
+    std::string key;
+    std::map<std::string, ToolInfo> tools;
+
+    bool has(const std::string& name) const {
+        auto it = tools.find(name);
+        return it != tools.end() && it->second.available;
+    }
+
+    const ToolInfo& get(const std::string& name) const {
+        static const ToolInfo none;
+        auto it = tools.find(name);
+        return it == tools.end() ? none : it->second;
+    }
+};
+
+std::string findInPath(const std::string& name) {
+    const char* env = std::getenv("PATH");
+    if (!env) return "";
+    std::string pathEnv = env;
+#ifdef _WIN32
+    const char sep = ';';
+    const std::vector<std::string> exts = {".exe", ".bat", ".cmd", ""};
+#else
+    const char sep = ':';
+    const std::vector<std::string> exts = {""};
+#endif
+    std::stringstream ss(pathEnv);
+    std::string dir;
+    while (std::getline(ss, dir, sep)) {
+        if (dir.empty()) continue;
+        for (const std::string& ext : exts) {
+            std::path candidate = std::path(dir) / (name + ext);
+            std::error_code ec;
+            if (std::is_regular_file(candidate, ec)) {
+                return candidate.string();
+            }
+        }
+    }
+    return "";
+}
+
+// identifies the file behind path (following symlinks, gcc is normally a link to gcc-12 or similar)
+std::string toolStamp(const std::string& path) {
+    if (path.empty()) return "-";
+    std::error_code ec;
+    std::path real = std::filesystem::canonical(path, ec);
+    if (ec) real = path;
+    std::string stamp = real.string();
+#ifdef _WIN32
+    stamp += "|" + std::to_string(std::filesystem::file_size(real, ec));
+    stamp += "|" + std::to_string(std::filesystem::last_write_time(real, ec).time_since_epoch().count());
+#else
+    struct stat st{};
+    if (stat(real.c_str(), &st) == 0) {
+        stamp += "|" + std::to_string((long long)st.st_size);
+        stamp += "|" + std::to_string((long long)st.st_mtime);
+        stamp += "|" + std::to_string((unsigned long long)st.st_ino);
+    }
+#endif
+    return stamp;
+}
+
+std::string toolchainKey(const std::map<std::string, ToolInfo>& tools) {
+    Sha256 h;
+    const char* env = std::getenv("PATH");
+    h.update(std::string(env ? env : ""));
+    for (const auto& [name, info] : tools) {
+        h.update("\n" + name + "=" + info.path + "|" + info.stamp);
+    }
+    return h.hex();
+}
+
+void probeTool(const std::string& name, ToolInfo& info) {
+    if (info.path.empty()) return;
+    std::string cmd;
+    if (name == "cl") {
+        // cl has no --version, it prints its banner (to stderr) when run with no args
+        cmd = "\"" + info.path + "\" 2>&1";
+    } else if (name == "link" || name == "lib") {
+        // msvc link and lib, there is also a coreutils link on unix, which we don't care about
+#ifdef _WIN32
+        info.available = true;
+#endif
+        return;
+    } else {
+        cmd = "\"" + info.path + "\" --version 2>&1";
+    }
+    int status = 0;
+    std::string out = runCapture(cmd, &status);
+    std::string first;
+    std::stringstream ss(out);
+    while (std::getline(ss, first)) {
+        first = strip(first);
+        if (!first.empty()) break;
+    }
+    info.version = first;
+    // ar on mac doesn't know --version, it's still there though
+    info.available = status == 0 || name == "cl" || name == "ar";
+}
+
+bool readToolchainCache(const std::path& p, Toolchain& t) {
+    std::ifstream file(p);
+    std::string line;
+    if (!std::getline(file, line) || line != BSCF_TOOLCHAIN_CACHE_VERSION) return false;
+    if (!std::getline(file, line) || line.rfind("key ", 0) != 0) return false;
+    t.key = line.substr(4);
+    while (std::getline(file, line)) {
+        // name \t available \t path \t version
+        std::vector<std::string> parts;
+        std::stringstream ss(line);
+        std::string part;
+        while (std::getline(ss, part, '\t')) parts.push_back(part);
+        if (parts.size() < 3) continue;
+        ToolInfo& info = t.tools[parts[0]];
+        info.available = parts[1] == "1";
+        info.path = parts[2];
+        info.version = parts.size() > 3 ? parts[3] : "";
+    }
+    return true;
+}
+
+void writeToolchainCache(const std::path& p, const Toolchain& t) {
+    std::stringstream ss;
+    ss << BSCF_TOOLCHAIN_CACHE_VERSION << std::endl;
+    ss << "key " << t.key << std::endl;
+    for (const auto& [name, info] : t.tools) {
+        ss << name << "\t" << (info.available ? "1" : "0") << "\t" << info.path << "\t" << info.version << std::endl;
+    }
+    writeFileAtomic(p, ss.str());
+}
+
+Toolchain loadToolchain() {
+    Toolchain t;
+    for (const std::string& name : BSCF_TOOLS) {
+        ToolInfo& info = t.tools[name];
+        info.path = findInPath(name);
+        info.stamp = toolStamp(info.path);
+    }
+    std::string key = toolchainKey(t.tools);
+    std::path cachePath = bscfHomeDir() / "toolchain.cache";
+    Toolchain cached;
+    if (readToolchainCache(cachePath, cached) && cached.key == key) {
+        for (auto& [name, info] : cached.tools) {
+            info.stamp = t.tools[name].stamp;
+        }
+        return cached;
+    }
+    // something changed, run the tools again
+    for (auto& [name, info] : t.tools) {
+        probeTool(name, info);
+    }
+    t.key = key;
+    writeToolchainCache(cachePath, t);
+    return t;
+}
+
+// loaded once per run
+const Toolchain& toolchain() {
+    static Toolchain t = loadToolchain();
+    return t;
+}
+
+bool isGitAvailable() {
+    return toolchain().has("git");
+}
+
+// identifies the tools a compiler uses down to the exact binary
+// goes into the build cache keys so upgrading the compiler rebuilds everything
+std::string toolFingerprint(const std::vector<std::string>& names) {
+    Sha256 h;
+    for (const std::string& name : names) {
+        const ToolInfo& info = toolchain().get(name);
+        h.update(name + "=" + info.path + "|" + info.stamp + "|" + info.version + "\n");
+    }
+    return h.hex();
+}
+
+#endif //SRC_TOOLCHAIN_H
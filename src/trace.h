@@ -0,0 +1,164 @@
+#pragma once
+#ifndef SRC_TRACE_H
+#define SRC_TRACE_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+
+// --trace file: where the time of a build goes, as chrome trace events (open it in ui.perfetto.dev or chrome://tracing)
+//     bscf . --trace build/trace.json build
+// bscf's own phases are in the categories
+//     parse: reading proj.bscf (and the projects it includes)
+//     fetch: git clones and pulls, archive downloads, gets from the remote cache
+//     gen: working out the actions of a target
+//     scan: module and include scans of the sources
+//     hash: hashing files, checking whether an action is up to date, cache keys
+// and every action that runs is an event in the category action, on the lane (thread) of the scheduler that ran it,
+// with its target, kind and exit status (and the worker, for compiles that went to one, see workers.h)
+// events go into a buffer of the thread that recorded them, nothing is shared or locked past the first event of a thread,
+// and the buffers are only written out at exit (after the scheduler joined its threads)
+// off, a span costs a branch
+
+struct TraceEvent {
+    const char* category;
+    std::string name;
+    long long start; // us since the trace started
+    long long duration;
+    std::string args; // "key": value pairs, ready to go in the json
+};
+
+struct TraceBuffer {
+    size_t lane;
+    std::string name;
+    std::vector<TraceEvent> events;
+};
+
+bool traceEnabled = false;
+std::string traceFile;
+std::chrono::steady_clock::time_point traceStart;
+std::mutex traceMutex; // only for adding buffers
+std::vector<std::unique_ptr<TraceBuffer>> traceBuffers;
+
+long long traceNow() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - traceStart).count();
+}
+
+// the buffer of this thread, made on its first event
+TraceBuffer& traceBuffer() {
+    thread_local TraceBuffer* buffer = nullptr;
+    if (!buffer) {
+        std::lock_guard<std::mutex> lock(traceMutex);
+        traceBuffers.push_back(std::make_unique<TraceBuffer>());
+        buffer = traceBuffers.back().get();
+        buffer->lane = traceBuffers.size() - 1;
+        buffer->name = buffer->lane == 0 ? "bscf" : "thread " + std::to_string(buffer->lane);
+    }
+    return *buffer;
+}
+
+// what the lane of this thread is called in the trace
+void traceThreadName(const std::string& name) {
+    if (traceEnabled) traceBuffer().name = name;
+}
+
+std::string traceEscape(const std::string& s) {
+    std::string out;
+    out.reserve(s.size());
+    for (char ch : s) {
+        if (ch == '"' || ch == '\\') {
+            out += '\\';
+            out += ch;
+        } else if ((unsigned char)ch < 0x20) {
+            char hex[8];
+            snprintf(hex, sizeof(hex), "\\u%04x", ch);
+            out += hex;
+        } else {
+            out += ch;
+        }
+    }
+    return out;
+}
+
+void writeTrace() {
+    if (!traceEnabled) return;
+    std::ofstream out(traceFile, std::ios::binary);
+    if (!out) {
+        fprintf(stderr, "Could not write the trace to %s\n", traceFile.c_str());
+        return;
+    }
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    for (const std::unique_ptr<TraceBuffer>& b : traceBuffers) {
+        out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << b->lane
+            << ",\"args\":{\"name\":\"" << traceEscape(b->name) << "\"}}";
+        first = false;
+        for (const TraceEvent& e : b->events) {
+            out << ",\n{\"name\":\"" << traceEscape(e.name) << "\",\"cat\":\"" << e.category << "\",\"ph\":\"X\",\"ts\":" << e.start
+                << ",\"dur\":" << e.duration << ",\"pid\":1,\"tid\":" << b->lane << ",\"args\":{" << e.args << "}}";
+        }
+    }
+    out << "\n]}\n";
+}
+
+// from here on every span is recorded, and the trace is written when bscf exits
+void startTrace(const std::string& file) {
+    traceFile = file;
+    traceStart = std::chrono::steady_clock::now();
+    traceEnabled = true;
+    traceBuffer(); // the main thread is lane 0
+    std::atexit(writeTrace);
+}
+
+// one event, from when it's made until it goes out of scope
+//     TraceSpan span("hash", "sha256");
+//     span.arg("file", path);
+class TraceSpan {
+public:
+    TraceSpan(const char* category, const std::string& name) {
+        if (!traceEnabled) return;
+        active = true;
+        this->category = category;
+        this->name = name;
+        start = traceNow();
+    }
+
+    ~TraceSpan() {
+        end();
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+    // before it goes out of scope
+    void end() {
+        if (!active) return;
+        active = false;
+        long long now = traceNow();
+        traceBuffer().events.push_back({category, std::move(name), start, now - start, std::move(args)});
+    }
+
+    void arg(const char* key, const std::string& value) {
+        if (!active) return;
+        args += (args.empty() ? "\"" : ",\"") + std::string(key) + "\":\"" + traceEscape(value) + "\"";
+    }
+
+    void arg(const char* key, long long value) {
+        if (!active) return;
+        args += (args.empty() ? "\"" : ",\"") + std::string(key) + "\":" + std::to_string(value);
+    }
+
+private:
+    bool active = false;
+    const char* category = "";
+    std::string name;
+    long long start = 0;
+    std::string args;
+};
+
+#endif //SRC_TRACE_H
@@ -0,0 +1,181 @@
+#pragma once
+#ifndef SRC_UNITY_H
+#define SRC_UNITY_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <functional>
+#include <filesystem>
+
+#include "util.h"
+#include "pch.h"
+
+// unity (jumbo) builds, a few sources are #included into one generated translation unit so headers are parsed once per batch
+//     UNITY target [files per batch, or a size like 256K] // default 8 files
+//     NOUNITY target source // compiled on its own, for files that clash with others (same static names, macros leaking, ...)
+// sources are batched per directory (so related files end up together), c and c++ separately,
+// and spread over the batches largest first so every batch has about the same amount of code to compile,
+// a source weighs what it and the project headers it includes come to (IncludeScanner::closureBytes, like the compile estimates),
+// so a small file pulling in a big header tree isn't taken for a cheap one
+// that overcounts headers shared inside a batch, which are parsed once, but it's the same overcount for every batch
+// the size budget is of the sources themselves, their shared headers would fill it long before the code does
+// batches are target/build/unity/<dir>_<n>.cpp (or .c) and only rewritten when what they include changes,
+// their depfile lists every source in them, so editing one source only recompiles its batch
+// the batches are only planned again when sources are added or removed (or the budget needs more batches),
+// otherwise a source growing a bit would move others around and recompile every batch
+
+const size_t BSCF_DEFAULT_UNITY_FILES = 8;
+
+struct UnityBatch {
+    std::string file; // the generated translation unit
+    std::vector<std::string> sources;
+};
+
+// the batches written last time, empty if they don't hold exactly these sources
+std::vector<std::vector<std::string>> readUnityBatches(const std::path& unityDir, const std::string& name, const std::string& ext,
+                                                       const std::vector<std::string>& sources) {
+    std::map<std::string, std::string> byPath;
+    for (const std::string& s : sources) {
+        byPath[std::absolute(s).lexically_normal().string()] = s;
+    }
+    std::vector<std::vector<std::string>> batches;
+    size_t found = 0;
+    for (size_t i = 0; std::exists(unityDir / (name + "_" + std::to_string(i) + ext)); i++) {
+        std::vector<std::string> batch;
+        for (const std::string& inc : scanIncludeLines(unityDir / (name + "_" + std::to_string(i) + ext))) {
+            auto it = byPath.find(std::absolute(unityDir / inc.substr(1, inc.size() - 2)).lexically_normal().string());
+            if (it == byPath.end()) return {};
+            batch.push_back(it->second);
+        }
+        found += batch.size();
+        batches.push_back(batch);
+    }
+    if (found != sources.size()) return {};
+    return batches;
+}
+
+// splits sources (all in one directory, all c or all c++) into balanced batches
+// maxFiles caps the files per batch, maxBytes the bytes of source (0 for no cap)
+// weigh is what a source costs to compile, its own size when there's none
+// previous is the layout from last time, kept if it still fits
+std::vector<std::vector<std::string>> planUnityBatches(std::vector<std::string> sources, size_t maxFiles, long long maxBytes,
+                                                       const std::vector<std::vector<std::string>>& previous = {},
+                                                       const std::function<long long(const std::string&)>& weigh = nullptr) {
+    std::vector<std::pair<long long, std::string>> sized;
+    long long total = 0;
+    for (const std::string& s : sources) {
+        std::error_code ec;
+        long long size = (long long)std::filesystem::file_size(s, ec);
+        if (ec) size = 0;
+        sized.emplace_back(weigh ? weigh(s) : size, s);
+        total += size;
+    }
+    size_t count = 1;
+    if (maxFiles > 0) count = std::max(count, (sized.size() + maxFiles - 1) / maxFiles);
+    if (maxBytes > 0) count = std::max(count, (size_t)((total + maxBytes - 1) / maxBytes));
+    count = std::min(count, sized.size());
+    if (previous.size() == count) {
+        bool fits = true;
+        for (const std::vector<std::string>& batch : previous) {
+            if (batch.size() < 2 || (maxFiles > 0 && batch.size() > maxFiles)) fits = false;
+        }
+        if (fits) return previous;
+    }
+    // largest first into the batch with the least code so far
+    std::sort(sized.begin(), sized.end(), [](const auto& a, const auto& b) {
+        return a.first != b.first ? a.first > b.first : a.second < b.second;
+    });
+    std::vector<std::vector<std::string>> batches(count);
+    std::vector<long long> bytes(count, 0);
+    for (const auto& [size, source] : sized) {
+        size_t best = count;
+        for (size_t i = 0; i < count; i++) {
+            if (maxFiles > 0 && batches[i].size() >= maxFiles) continue;
+            if (best == count || bytes[i] < bytes[best]) best = i;
+        }
+        if (best == count) {
+            // every batch is full (the byte budget made fewer batches than the file cap needs)
+            batches.emplace_back();
+            bytes.push_back(0);
+            best = count++;
+        }
+        batches[best].push_back(source);
+        bytes[best] += size;
+    }
+    for (std::vector<std::string>& batch : batches) {
+        std::sort(batch.begin(), batch.end());
+    }
+    return batches;
+}
+
+// only written when it changes, its mtime is an input of the batch's compile
+void writeUnityFile(const std::path& file, const std::vector<std::string>& sources) {
+    std::create_directories(file.parent_path());
+    std::string contents = "// generated by bscf, see UNITY in proj.bscf\n";
+    for (const std::string& source : sources) {
+        contents += "#include \"" + std::relative(std::absolute(source), std::absolute(file.parent_path())).generic_string() + "\"\n";
+    }
+    if (!std::exists(file) || readFile(file) != contents) {
+        writeFileAtomic(file, contents);
+    }
+}
+
+// sources are paths of the target's compilable files, relative to the project root like t.sources
+// returns the batches (with more than one source), the rest is left in sources
+std::vector<UnityBatch> makeUnityBatches(const std::path& targetPath, std::vector<std::string>& sources,
+                                         const std::vector<std::string>& excluded, size_t maxFiles, long long maxBytes,
+                                         const std::function<long long(const std::string&)>& weigh = nullptr) {
+    // dir + language -> sources
+    std::map<std::pair<std::string, std::string>, std::vector<std::string>> groups;
+    std::vector<std::string> rest;
+    for (const std::string& s : sources) {
+        std::string ext = std::path(s).extension().string();
+        bool cxx = ext == ".cpp" || ext == ".cxx";
+        bool c = ext == ".c" || ext == ".cc";
+        if ((!cxx && !c) || std::find(excluded.begin(), excluded.end(), s) != excluded.end()) {
+            rest.push_back(s);
+            continue;
+        }
+        groups[{std::path(s).parent_path().string(), cxx ? ".cpp" : ".c"}].push_back(s);
+    }
+    std::vector<UnityBatch> result;
+    for (auto& [key, group] : groups) {
+        std::string dir = std::relative(key.first, targetPath).generic_string();
+        dir = dir == "." ? "root" : replace(dir, "/", "_");
+        std::path unityDir = targetPath / "build" / "unity";
+        std::vector<std::vector<std::string>> batches = planUnityBatches(group, maxFiles, maxBytes, readUnityBatches(unityDir, dir, key.second, group), weigh);
+        // numbered without gaps, readUnityBatches stops at the first missing one
+        size_t written = 0;
+        for (const std::vector<std::string>& batch : batches) {
+            if (batch.size() < 2) {
+                rest.insert(rest.end(), batch.begin(), batch.end());
+                continue;
+            }
+            UnityBatch b;
+            b.file = (unityDir / (dir + "_" + std::to_string(written++) + key.second)).string();
+            b.sources = batch;
+            writeUnityFile(b.file, b.sources);
+            result.push_back(b);
+        }
+        // batches left over from a bigger layout (with gaps even, as earlier versions numbered them)
+        std::error_code ec;
+        std::vector<std::path> stale;
+        for (const auto& entry : std::filesystem::directory_iterator(unityDir, ec)) {
+            std::string file = entry.path().filename().string();
+            std::string prefix = dir + "_";
+            if (file.rfind(prefix, 0) != 0 || entry.path().extension().string() != key.second) continue;
+            std::string n = file.substr(prefix.size(), file.size() - prefix.size() - key.second.size());
+            if (n.empty() || n.find_first_not_of("0123456789") != std::string::npos || n.size() > 9) continue;
+            if (std::stoul(n) >= written) stale.push_back(entry.path());
+        }
+        for (const std::path& file : stale) {
+            std::filesystem::remove(file, ec);
+        }
+    }
+    sources = rest;
+    return result;
+}
+
+#endif //SRC_UNITY_H
@@ -6,7 +6,32 @@
 #include <filesystem>
 #include <vector>
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <regex>
+#include <cstdlib>
+#include <cstdio>
+#include <random>
+// these need to come before the using namespace std::filesystem below, or std::__detail becomes ambiguous
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#include "stats.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN // keeps the old winsock.h out, net.h uses winsock2.h
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#endif
 
 #ifdef _WIN32
 #define NULLIFY_CMD " > NUL 2>&1"
@@ -43,8 +68,10 @@ std::string replace(std::string str, const std::string& from, const std::string&
 }
 
 std::vector<std::path> recurseDir(const std::path& dir) {
+    BSCF_STAT_TIME(Stat::DIR_ENTRIES);
     std::vector<std::path> files;
     for (const auto& entry : std::directory_iterator(dir)) {
+        BSCF_STAT_ADD(Stat::DIR_ENTRIES, 1);
         if (entry.is_directory()) {
             std::vector<std::path> subFiles = recurseDir(entry.path());
             files.insert(files.end(), subFiles.begin(), subFiles.end());
@@ -56,8 +83,10 @@ std::vector<std::path> recurseDir(const std::path& dir) {
 }
 
 std::vector<std::path> globDir(const std::path& dir) {
+    BSCF_STAT_TIME(Stat::DIR_ENTRIES);
     std::vector<std::path> files;
     for (const auto& entry : std::directory_iterator(dir)) {
+        BSCF_STAT_ADD(Stat::DIR_ENTRIES, 1);
         if (!entry.is_directory()) {
             files.push_back(entry.path());
         }
@@ -67,10 +96,171 @@ std::vector<std::path> globDir(const std::path& dir) {
 
 std::string strip(std::string s) {
     // remove leading and trailing whitespace /n/r/t etc
+    BSCF_STAT_TIME(Stat::REGEX);
+    BSCF_STAT_ADD(Stat::REGEX, 2);
     s = std::regex_replace(s, std::regex("^\\s+"), "");
     s = std::regex_replace(s, std::regex("\\s+$"), "");
     return s;
 
 }
 
+// a plain number like "8", false if s isn't one (empty, not only digits, or too big)
+bool parseCount(const std::string& s, size_t& n) {
+    if (s.empty() || s.find_first_not_of("0123456789") != std::string::npos) return false;
+    try {
+        n = std::stoul(s);
+    } catch (...) {
+        return false;
+    }
+    return true;
+}
+
+std::string readFile(const std::path& p) {
+    std::ifstream file(p, std::ios::binary);
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    return buffer.str();
+}
+
+// write to a temp file next to p, then rename over p
+// so other bscf processes never see a half written file
+bool writeFileAtomic(const std::path& p, const std::string& contents) {
+    std::path tmp = p;
+    tmp += ".tmp" + std::to_string(std::random_device{}());
+    {
+        std::ofstream file(tmp, std::ios::binary);
+        if (!file) return false;
+        file << contents;
+        if (!file) return false;
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp, p, ec);
+    if (ec) {
+        std::filesystem::remove(tmp, ec);
+        return false;
+    }
+    return true;
+}
+
+// held while printing from the build threads, so their lines don't interleave
+std::mutex bscfOutputMutex;
+
+// run cmd and return its stdout, exit status goes in status (if given)
+std::string runCapture(const std::string& cmd, int* status = nullptr) {
+    BSCF_STAT_TIME(Stat::SPAWNS);
+    BSCF_STAT_ADD(Stat::SPAWNS, 1);
+    std::string out;
+#ifdef _WIN32
+    FILE* pipe = _popen(cmd.c_str(), "r");
+#else
+    FILE* pipe = popen(cmd.c_str(), "r");
+#endif
+    if (!pipe) {
+        if (status) *status = -1;
+        return out;
+    }
+    char buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), pipe)) > 0) {
+        out.append(buffer, n);
+    }
+#ifdef _WIN32
+    int s = _pclose(pipe);
+#else
+    int s = pclose(pipe);
+#endif
+    if (status) *status = s;
+    return out;
+}
+
+// exclusive lock on a lock file, held until the object goes away
+// used for the few things several bscf processes update in place (like cache stats)
+class FileLock {
+private:
+#ifdef _WIN32
+    HANDLE handle = INVALID_HANDLE_VALUE;
+#else
+    int fd = -1;
+#endif
+public:
+    explicit FileLock(const std::path& p) {
+#ifdef _WIN32
+        handle = CreateFileW(p.wstring().c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS, 0, NULL);
+        if (handle != INVALID_HANDLE_VALUE) {
+            OVERLAPPED ov = {};
+            LockFileEx(handle, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &ov);
+        }
+#else
+        fd = open(p.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd >= 0) flock(fd, LOCK_EX);
+#endif
+    }
+
+    ~FileLock() {
+#ifdef _WIN32
+        if (handle != INVALID_HANDLE_VALUE) {
+            OVERLAPPED ov = {};
+            UnlockFileEx(handle, 0, 1, 0, &ov);
+            CloseHandle(handle);
+        }
+#else
+        if (fd >= 0) {
+            flock(fd, LOCK_UN);
+            close(fd);
+        }
+#endif
+    }
+
+    FileLock(const FileLock&) = delete;
+    FileLock& operator=(const FileLock&) = delete;
+};
+
+// true if the environment variable is set to something other than "" or "0"
+bool envFlag(const char* name) {
+    const char* value = std::getenv(name);
+    return value != nullptr && std::string(value) != "" && std::string(value) != "0";
+}
+
+// per user directory for everything bscf keeps between projects (recipes, caches, etc)
+// BSCF_HOME overrides the default of ~/.bscf
+std::path bscfHomeDir() {
+    std::path home;
+    if (const char* env = std::getenv("BSCF_HOME")) {
+        home = env;
+    } else {
+#ifdef _WIN32
+        const char* user = std::getenv("USERPROFILE");
+#else
+        const char* user = std::getenv("HOME");
+#endif
+        home = std::path(user ? user : ".") / ".bscf";
+    }
+    std::create_directories(home);
+    return home;
+}
+
+// read the commit a git checkout is on without spawning git
+// returns an empty string if it can't be worked out
+std::string gitHeadCommit(const std::path& repo) {
+    std::path gitDir = repo / ".git";
+    if (!std::exists(gitDir / "HEAD")) return "";
+    std::string head = strip(readFile(gitDir / "HEAD"));
+    if (head.rfind("ref: ", 0) != 0) return head; // detached head
+    std::string ref = head.substr(5);
+    if (std::exists(gitDir / ref)) {
+        return strip(readFile(gitDir / ref));
+    }
+    // fresh clones keep most refs in packed-refs
+    std::ifstream packed(gitDir / "packed-refs");
+    std::string line;
+    while (std::getline(packed, line)) {
+        if (line.empty() || line[0] == '#' || line[0] == '^') continue;
+        size_t space = line.find(' ');
+        if (space != std::string::npos && strip(line.substr(space + 1)) == ref) {
+            return line.substr(0, space);
+        }
+    }
+    return "";
+}
+
 #endif //SRC_UTIL_H
@@ -3,15 +3,33 @@
 #define SRC_VERSIONING_H
 
 #include <fstream>
+#include <ctime>
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#endif
 
 #include "whereami.h"
 #include "util.h"
 
-void versionSystem() {
-    // check if version.txt exists in the same directory as the executable
-    // if not print an error message and exit
-    // if it does, read the file and print the contents
+// the update check used to clone/pull bscf and ask on std::cin before every command
+// now versionSystem only ever reads files, the network part runs in a detached child at most once per interval
+// and the interactive part is the selfupdate command
+// interval is BSCF_UPDATE_INTERVAL in seconds (default one day, 0 turns the background check off)
+// the time of the last check is kept in ~/.bscf/update.state
+// the background fetch and selfupdate both hold ~/.bscf/update.lock while they use bscf_repo, so a pull can't land
+// in the middle of the rebuild (on windows the background fetch takes no lock, it's only skipped when selfupdate is run)
+
+const long long BSCF_DEFAULT_UPDATE_INTERVAL = 60 * 60 * 24;
+
+struct bscfExeInfo {
+    std::path executablePath; // dir
+    std::string executableName;
+    std::path versionPath;
+    std::path bscfRepoPath;
+};
 
+bscfExeInfo getExeInfo() {
     int length = wai_getExecutablePath(NULL, 0, NULL);
     int dirname_length;
     char* path = (char*)malloc(length + 1);
@@ -20,80 +38,173 @@ void versionSystem() {
     std::string exe = std::string(path);
     free(path);
 
+    bscfExeInfo info;
+    info.executablePath = std::path(exe).parent_path();
+    info.executableName = std::path(exe).filename().string();
+    info.versionPath = info.executablePath / "version.txt";
+    info.bscfRepoPath = info.executablePath / "bscf_repo";
+    return info;
+}
 
-    std::path executablePath = std::path(exe).parent_path();
-    std::path versionPath = executablePath / "version.txt";
-    // executableName
-    std::string executableName = std::path(exe).filename().string();
+std::string readVersion(const std::path& p) {
+    std::ifstream file(p);
+    std::string version;
+    std::getline(file, version);
+    return strip(version);
+}
 
-    if (!std::filesystem::exists(versionPath)) {
+long long updateInterval() {
+    if (const char* env = std::getenv("BSCF_UPDATE_INTERVAL")) {
+        try {
+            return std::stoll(env);
+        } catch (...) {
+            std::cerr << "Invalid BSCF_UPDATE_INTERVAL: " << env << std::endl;
+        }
+    }
+    return BSCF_DEFAULT_UPDATE_INTERVAL;
+}
+
+std::string updateFetchCmd(const std::path& bscfRepoPath) {
+    if (std::filesystem::exists(bscfRepoPath)) {
+        return "cd " + bscfRepoPath.string() + " && git pull --force";
+    }
+    return "git clone https://github.com/bscf-db/bscf " + bscfRepoPath.string();
+}
+
+// start fetching the latest bscf in the background if the last check is old enough
+// the result is only looked at on the next run, so nothing here waits on the network
+void backgroundUpdateCheck(const bscfExeInfo& info) {
+    long long interval = updateInterval();
+    if (interval <= 0) return;
+    std::path statePath = bscfHomeDir() / "update.state";
+    long long now = (long long)std::time(nullptr);
+    long long last = 0;
+    std::ifstream state(statePath);
+    state >> last;
+    state.close();
+    if (now - last < interval) return;
+    // write the time first so other bscf processes started right now don't all fetch at once
+    writeFileAtomic(statePath, std::to_string(now) + "\n");
+#ifdef _WIN32
+    std::string cmd = "start \"\" /B cmd /C \"set GIT_TERMINAL_PROMPT=0 && " + updateFetchCmd(info.bscfRepoPath) + NULLIFY_CMD "\"";
+    system(cmd.c_str());
+#else
+    // forked twice so the fetch isn't a child of ours, it outlives this run and holds the lock while it runs
+    pid_t pid = fork();
+    if (pid == 0) {
+        setsid();
+        // not holding on to our output, a pipe reading it would wait for the fetch
+        int null = open("/dev/null", O_RDWR);
+        if (null >= 0) {
+            dup2(null, 0);
+            dup2(null, 1);
+            dup2(null, 2);
+            if (null > 2) close(null);
+        }
+        if (fork() == 0) {
+            FileLock lock(bscfHomeDir() / "update.lock");
+            std::string cmd = "GIT_TERMINAL_PROMPT=0 " + updateFetchCmd(info.bscfRepoPath) + " < /dev/null" NULLIFY_CMD;
+            _exit(system(cmd.c_str()) == 0 ? 0 : 1);
+        }
+        _exit(0);
+    }
+    if (pid > 0) waitpid(pid, nullptr, 0);
+#endif
+}
+
+// backgroundCheck is off when this run does selfupdate, that fetches itself
+void versionSystem(bool backgroundCheck = true) {
+    // check if version.txt exists in the same directory as the executable
+    // if not print an error message and exit
+    // if it does, read the file and print the contents
+    bscfExeInfo info = getExeInfo();
+
+    if (!std::filesystem::exists(info.versionPath)) {
         std::cout << "version.txt not found in the same directory as the executable" << std::endl;
         exit(1);
     }
 
-    std::ifstream versionFile(versionPath);
-    std::string version;
-    std::getline(versionFile, version);
-    version = strip(version);
+    std::string version = readVersion(info.versionPath);
     std::cout << version << std::endl;
-    versionFile.close();
 
-    if (std::exists(executablePath / ("old_" + executableName))) {
-        std::filesystem::remove(executablePath / ("old_" + executableName));
+    if (std::exists(info.executablePath / ("old_" + info.executableName))) {
+        std::filesystem::remove(info.executablePath / ("old_" + info.executableName));
     }
 
-    std::path bscfRepoPath = executablePath / "bscf_repo";
-    std::cout << "Checking for updates..." << std::endl;
-    std::string cmd;
-    if (std::filesystem::exists(bscfRepoPath)) {
-        cmd = "cd " + bscfRepoPath.string() + " && git pull --force" + NULLIFY_CMD;
-    } else {
-        cmd = "git clone https://github.com/bscf-db/bscf " + bscfRepoPath.string() + NULLIFY_CMD;
+    // whatever the last background check fetched
+    if (std::filesystem::exists(info.bscfRepoPath / "version.txt")) {
+        std::string bscfVersion = readVersion(info.bscfRepoPath / "version.txt");
+        if (!bscfVersion.empty() && version != bscfVersion) {
+            std::cout << "New version available: '" << bscfVersion << "', run 'bscf . selfupdate' to update" << std::endl;
+        }
     }
+
+    if (backgroundCheck) backgroundUpdateCheck(info);
+}
+
+// the old interactive update, fetches now, asks, then rebuilds and replaces the executable
+void selfUpdate() {
+    bscfExeInfo info = getExeInfo();
+    std::path executablePath = info.executablePath;
+    std::string executableName = info.executableName;
+    std::path versionPath = info.versionPath;
+    std::path bscfRepoPath = info.bscfRepoPath;
+
+    std::string version = readVersion(versionPath);
+
+    // waits for a background fetch that's still running, and keeps the next one out until this is done
+    FileLock lock(bscfHomeDir() / "update.lock");
+    std::cout << "Checking for updates..." << std::endl;
+    std::string cmd = updateFetchCmd(bscfRepoPath) + NULLIFY_CMD;
     system(cmd.c_str());
+    writeFileAtomic(bscfHomeDir() / "update.state", std::to_string((long long)std::time(nullptr)) + "\n");
+
+    std::string bscfVersion = readVersion(bscfRepoPath / "version.txt");
 
-    std::ifstream bscfVersionFile(bscfRepoPath / "version.txt");
-    std::string bscfVersion;
-    std::getline(bscfVersionFile, bscfVersion);
-    bscfVersion = strip(bscfVersion);
-    bscfVersionFile.close();
-
-    if (version != bscfVersion) {
-        std::cout << "New version available: '" << bscfVersion << "'" << std::endl;
-        std::cout << "Current version: '" << version << "'" << std::endl;
-
-        std::cout << "A new version of bscf is available. Would you like to update? (y/n)" << std::endl;
-        std::string response;
-        std::cin >> response;
-        if (response == "y") {
-            std::cout << "Building new version..." << std::endl;
+    if (bscfVersion.empty()) {
+        std::cout << "Failed to check for updates" << std::endl;
+        return;
+    }
+
+    if (version == bscfVersion) {
+        std::cout << "bscf is up to date" << std::endl;
+        return;
+    }
+
+    std::cout << "New version available: '" << bscfVersion << "'" << std::endl;
+    std::cout << "Current version: '" << version << "'" << std::endl;
+
+    std::cout << "A new version of bscf is available. Would you like to update? (y/n)" << std::endl;
+    std::string response;
+    std::cin >> response;
+    if (response == "y") {
+        std::cout << "Building new version..." << std::endl;
 #ifdef _WIN32
-            cmd = "cd " + bscfRepoPath.string() + " && ..\\bscf.exe NOUPDATE";
+        cmd = "cd " + bscfRepoPath.string() + " && ..\\bscf.exe NOUPDATE";
 #else
-            cmd = "cd " + bscfRepoPath.string() + " && ../bscf NOUPDATE";
+        cmd = "cd " + bscfRepoPath.string() + " && ../bscf NOUPDATE";
 #endif
-            system(cmd.c_str());
-            std::cout << "Build complete." << std::endl;
-            // now replace the old version with the new version
-            // wait, how do we do that?
-            // we can't just replace the executable because it's running
-            // we need to replace the executable that will be run next time
-            // we need to rename the current executable (if already exist, delete), then copy the new executable to the old executable's name
-            // then exit
-            if (std::filesystem::exists(executablePath / ("old_" + executableName))) {
-                std::filesystem::remove(executablePath / ("old_" + executableName));
-            }
-            std::filesystem::rename(executablePath / executableName, executablePath / ("old_" + executableName));
-            std::filesystem::copy(bscfRepoPath / "build" / "bin" / executableName, executablePath / executableName);
-            // delete old version.txt
-            std::filesystem::remove(versionPath);
-            // copy new version.txt
-            std::filesystem::copy(bscfRepoPath / "version.txt", versionPath);
-            std::cout << "Update complete. Please restart the program." << std::endl;
-            exit(0);
-        } else {
-            std::cout << "Update declined." << std::endl;
+        system(cmd.c_str());
+        std::cout << "Build complete." << std::endl;
+        // now replace the old version with the new version
+        // wait, how do we do that?
+        // we can't just replace the executable because it's running
+        // we need to replace the executable that will be run next time
+        // we need to rename the current executable (if already exist, delete), then copy the new executable to the old executable's name
+        // then exit
+        if (std::filesystem::exists(executablePath / ("old_" + executableName))) {
+            std::filesystem::remove(executablePath / ("old_" + executableName));
         }
+        std::filesystem::rename(executablePath / executableName, executablePath / ("old_" + executableName));
+        std::filesystem::copy(bscfRepoPath / "build" / "bin" / executableName, executablePath / executableName);
+        // delete old version.txt
+        std::filesystem::remove(versionPath);
+        // copy new version.txt
+        std::filesystem::copy(bscfRepoPath / "version.txt", versionPath);
+        std::cout << "Update complete. Please restart the program." << std::endl;
+        exit(0);
+    } else {
+        std::cout << "Update declined." << std::endl;
     }
 }
 
@@ -0,0 +1,491 @@
+#pragma once
+#ifndef SRC_WORKERS_H
+#define SRC_WORKERS_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <regex>
+
+#include "util.h"
+#include "net.h"
+#include "toolchain.h"
+#include "resources.h"
+#include "trace.h"
+
+// distributed compiles: compiles that miss the object cache can run on other bscf processes (workers) instead of here
+//     bscf . worker [unix:/path/to.sock | port] // serves -j N compiles at once on that socket (default 127.0.0.1:8518)
+//     BSCF_WORKERS=unix:/tmp/w1.sock,127.0.0.1:8519 bscf . build // builds with them
+// a job is the preprocessed source (the object cache's -E pass makes it, headers don't have to exist on the worker)
+// and the compile flags that still matter after preprocessing, the worker compiles it and sends back the object and stderr
+// only plain gcc/clang compiles go out: no msvc, no modules (their BMIs are files on this machine)
+// workers say how many slots they have when the build starts, a compile goes to the worker with the most room,
+// and runs here if every slot is taken, so the build runs -j N here plus the slots of the workers
+// whatever runs here (other actions, and compiles no worker took or that a worker failed) takes one of the -j N local
+// slots first, a compile waiting for one still goes to a worker if one frees up in the meantime
+// a worker that can't be reached, drops the connection (crashed) or takes longer than BSCF_WORKER_TIMEOUT seconds
+// (default 60) gets no more jobs for a while, and the compile runs here instead
+// a worker only runs gcc/g++/cc/c++/clang/clang++ (by name, found in its own PATH), with the same version the coordinator has,
+// and only the code generation and warning flags on the list in workerArgAllowed (none with a value that names a file
+// or a program), so whoever can reach it can't run anything else with it
+// the coordinator's -ffile-prefix-map is sent as the directory it maps (prefix), the worker makes the flag itself
+// it only listens locally (127.0.0.1 or a unix socket), a worker box is reached over an ssh tunnel or a socket forwarded into a container
+// for testing, BSCF_WORKER_DELAY=seconds makes a worker slow and BSCF_WORKER_CRASH_AFTER=n makes it exit on its nth job
+
+const int BSCF_DEFAULT_WORKER_PORT = 8518;
+const int BSCF_DEFAULT_WORKER_TIMEOUT = 60;
+const int BSCF_WORKER_RETRY_SECONDS = 30;
+
+// messages are records of "name length\n" and that many bytes, up to a record named end
+typedef std::vector<std::pair<std::string, std::string>> WireMessage;
+
+bool sendWireMessage(bscfSocket s, const WireMessage& message) {
+    std::string data;
+    for (const auto& [name, value] : message) {
+        data += name + " " + std::to_string(value.size()) + "\n" + value;
+    }
+    data += "end 0\n";
+    return netSendAll(s, data);
+}
+
+bool recvWireMessage(bscfSocket s, WireMessage& message) {
+    message.clear();
+    while (true) {
+        std::string line;
+        char c;
+        while (true) {
+            if (recv(s, &c, 1, 0) != 1) return false;
+            if (c == '\n') break;
+            line += c;
+            if (line.size() > 256) return false;
+        }
+        size_t space = line.find(' ');
+        if (space == std::string::npos) return false;
+        std::string name = line.substr(0, space);
+        size_t len;
+        try {
+            len = std::stoull(line.substr(space + 1));
+        } catch (...) {
+            return false;
+        }
+        if (name == "end") return true;
+        std::string value;
+        if (!netRecvExact(s, value, len)) return false;
+        message.emplace_back(name, value);
+    }
+}
+
+std::string wireValue(const WireMessage& message, const std::string& name) {
+    for (const auto& [n, value] : message) {
+        if (n == name) return value;
+    }
+    return "";
+}
+
+// unix:/path or [host:]port
+bscfSocket connectWorker(const std::string& address, int timeoutSeconds) {
+#ifndef _WIN32
+    if (address.rfind("unix:", 0) == 0) return netConnectUnix(address.substr(5), timeoutSeconds);
+#endif
+    size_t colon = address.rfind(':');
+    std::string host = colon == std::string::npos ? "127.0.0.1" : address.substr(0, colon);
+    try {
+        return netConnect(host, std::stoi(address.substr(colon == std::string::npos ? 0 : colon + 1)), timeoutSeconds);
+    } catch (...) {
+        return BSCF_BAD_SOCKET;
+    }
+}
+
+// a compiler name (no path) a worker runs
+bool workerToolAllowed(const std::string& tool) {
+    if (tool.find('/') != std::string::npos || tool.find('\\') != std::string::npos) return false;
+    BSCF_STAT_ADD(Stat::REGEX, 1);
+    static const std::regex allowed("(gcc|g\\+\\+|cc|c\\+\\+|clang|clang\\+\\+)(-[0-9.]+)?");
+    return std::regex_match(tool, allowed);
+}
+
+// where tool is (a path is taken as it is, a name is looked up in PATH), empty if nowhere
+std::string workerToolPath(const std::string& tool) {
+    if (std::path(tool).has_parent_path()) return std::is_regular_file(tool) ? tool : "";
+    return findInPath(tool);
+}
+
+// the first line of tool --version, probed once, empty if it's not there
+// the same on both ends or the objects would differ from local ones
+std::string workerToolVersion(const std::string& tool) {
+    static std::mutex mutex;
+    static std::map<std::string, std::string> versions;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = versions.find(tool);
+    if (it != versions.end()) return it->second;
+    ToolInfo info;
+    info.path = workerToolPath(tool);
+    probeTool(std::path(tool).filename().string(), info);
+    return versions[tool] = info.available ? info.version : "";
+}
+
+// a flag a worker passes to the compiler: a list of what only changes the code or the warnings
+// a value is a word or a number, never a path or a program (-fmodule-mapper=|cmd runs cmd, -fpass-plugin= loads a .so)
+bool workerArgAllowed(const std::string& arg) {
+    BSCF_STAT_ADD(Stat::REGEX, 1);
+    static const std::regex allowed(
+        "-O([0-3sz]|g|fast)?|-g([0-3]|gdb)?|-std=[a-z0-9+]+|-w|-pedantic(-errors)?|-ansi|-pipe|-pthread"
+        "|-W[a-z0-9+-]+(=[a-z0-9]+)?"
+        "|-m(arch|tune|cpu)=[a-z0-9_.-]+|-m(32|64|sse[0-9.]*|avx[0-9a-z]*|fma|bmi2?|popcnt|lzcnt|no-red-zone)"
+        "|-f(no-)?(pic|PIC|pie|PIE|exceptions|rtti|strict-aliasing|omit-frame-pointer|common|fast-math|function-sections"
+        "|data-sections|stack-protector(-strong|-all)?|inline-functions|unroll-loops|signed-char|unsigned-char"
+        "|threadsafe-statics|math-errno|builtin|asynchronous-unwind-tables|stack-clash-protection|permissive|char8_t"
+        "|diagnostics-color|color-diagnostics|visibility-inlines-hidden)"
+        "|-fvisibility=(default|hidden)|-fdiagnostics-color=(auto|always|never)");
+    return std::regex_match(arg, allowed);
+}
+
+// the words of a compile command the worker needs for the preprocessed source:
+// no include dirs, defines, depfile, pch, language, source or output
+std::vector<std::string> remoteCompileArgs(const std::string& cmd, const std::string& source, const std::string& object) {
+    std::vector<std::string> words;
+    std::stringstream ss(cmd);
+    std::string w;
+    while (ss >> w) words.push_back(w);
+    static const std::vector<std::string> withArg = {"-o", "-x", "-include", "-imacros", "-isystem", "-iquote", "-idirafter",
+                                                     "-MF", "-MT", "-MQ", "-I", "-D", "-U"};
+    static const std::vector<std::string> dropped = {"-c", "-MMD", "-MD", "-MP", "-M", "-MM", "-fpch-deps"};
+    // sent as prefix instead, see remoteCompile
+    static const std::string prefixMap = "-ffile-prefix-map=";
+    std::vector<std::string> args;
+    for (size_t i = 0; i < words.size(); i++) {
+        const std::string& word = words[i];
+        if (std::find(withArg.begin(), withArg.end(), word) != withArg.end()) {
+            i++;
+            continue;
+        }
+        if (std::find(dropped.begin(), dropped.end(), word) != dropped.end() || word == source || word == object) continue;
+        if (i > 0 && (word.rfind("-I", 0) == 0 || word.rfind("-D", 0) == 0 || word.rfind("-U", 0) == 0)) continue;
+        if (word.rfind(prefixMap, 0) == 0) continue;
+        // the worker would refuse it, so it's compiled here
+        if (i > 0 && !workerArgAllowed(word)) return {};
+        args.push_back(word);
+    }
+    // the worker runs the compiler of that name from its own PATH
+    if (!args.empty()) args[0] = std::path(args[0]).filename().string();
+    if (!args.empty() && !workerToolAllowed(args[0])) return {};
+    return args;
+}
+
+class WorkerPool {
+public:
+    // asks every worker in BSCF_WORKERS how many slots it has
+    WorkerPool() {
+        const char* env = std::getenv("BSCF_WORKERS");
+        if (!env) return;
+        const char* timeout = std::getenv("BSCF_WORKER_TIMEOUT");
+        if (timeout) timeoutSeconds = std::max(1, std::atoi(timeout));
+        std::stringstream ss(env);
+        std::string address;
+        while (std::getline(ss, address, ',')) {
+            address = strip(address);
+            if (address.empty()) continue;
+            Worker w;
+            w.address = address;
+            bscfSocket s = connectWorker(address, 5);
+            WireMessage reply;
+            if (s != BSCF_BAD_SOCKET && sendWireMessage(s, {{"hello", ""}}) && recvWireMessage(s, reply)) {
+                w.slots = (size_t)std::max(0, std::atoi(wireValue(reply, "slots").c_str()));
+            }
+            if (s != BSCF_BAD_SOCKET) bscfCloseSocket(s);
+            if (w.slots == 0) {
+                std::cerr << "Worker " << address << " is not reachable, compiling without it" << std::endl;
+                continue;
+            }
+            workers.push_back(w);
+        }
+        if (!workers.empty()) std::cout << "# Compiling on " << workers.size() << " worker(s) with " << slots() << " slots" << std::endl;
+    }
+
+    size_t slots() {
+        size_t n = 0;
+        for (const Worker& w : workers) n += w.slots;
+        return n;
+    }
+
+    // a worker with a free slot (the emptiest), -1 if there's none
+    int acquire() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return pick();
+    }
+
+    // failed: the worker didn't do the job (not a compile error), it's left alone for a while
+    void release(int i, bool failed) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            workers[i].busy--;
+            if (failed) {
+                workers[i].downUntil = std::chrono::steady_clock::now() + std::chrono::seconds(BSCF_WORKER_RETRY_SECONDS);
+            }
+        }
+        slotFree.notify_all();
+    }
+
+    // how many actions may run here at once (-j), 0 for no limit
+    void setLocalSlots(size_t n) {
+        std::lock_guard<std::mutex> lock(mutex);
+        localSlots = n;
+    }
+
+    // waits for a worker slot (if remote is set) or a local one, whichever frees up first
+    // returns the worker, or -1 for a local slot (give that back with releaseLocal)
+    int acquireAny(bool remote) {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            if (remote) {
+                int best = pick();
+                if (best >= 0) return best;
+            }
+            if (localSlots == 0 || localBusy < localSlots) {
+                localBusy++;
+                return -1;
+            }
+            // a worker coming back from being down doesn't notify
+            slotFree.wait_for(lock, std::chrono::seconds(1));
+        }
+    }
+
+    void releaseLocal() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            localBusy--;
+        }
+        slotFree.notify_all();
+    }
+
+    // never again, it has another compiler
+    void retire(int i) {
+        std::lock_guard<std::mutex> lock(mutex);
+        workers[i].downUntil = std::chrono::steady_clock::time_point::max();
+    }
+
+    std::string address(int i) {
+        return workers[i].address;
+    }
+
+    int timeoutSeconds = BSCF_DEFAULT_WORKER_TIMEOUT;
+
+private:
+    struct Worker {
+        std::string address;
+        size_t slots = 0;
+        size_t busy = 0;
+        std::chrono::steady_clock::time_point downUntil;
+    };
+
+    std::mutex mutex;
+    std::condition_variable slotFree;
+    std::vector<Worker> workers;
+    size_t localSlots = 0;
+    size_t localBusy = 0;
+
+    // under the mutex
+    int pick() {
+        auto now = std::chrono::steady_clock::now();
+        int best = -1;
+        for (size_t i = 0; i < workers.size(); i++) {
+            const Worker& w = workers[i];
+            if (w.busy >= w.slots || now < w.downUntil) continue;
+            if (best < 0 || w.busy * workers[best].slots < workers[best].busy * w.slots) best = (int)i;
+        }
+        if (best >= 0) workers[best].busy++;
+        return best;
+    }
+};
+
+WorkerPool& workerPool() {
+    static WorkerPool pool;
+    return pool;
+}
+
+// one of the local slots, for as long as it's around
+class LocalSlot {
+public:
+    LocalSlot() {
+        workerPool().acquireAny(false);
+    }
+    ~LocalSlot() {
+        workerPool().releaseLocal();
+    }
+    LocalSlot(const LocalSlot&) = delete;
+    LocalSlot& operator=(const LocalSlot&) = delete;
+};
+
+// compiles the preprocessed source pp on worker i into object, false if the worker couldn't (then it should run here)
+// ok says whether the compile itself succeeded, its stderr ends up in errFile either way
+bool remoteCompile(int i, const std::string& cmd, const std::string& source, const std::string& pp, const std::string& object,
+                   const std::path& errFile, bool& ok) {
+    std::vector<std::string> args = remoteCompileArgs(cmd, source, object);
+    if (args.empty()) return false;
+    // sent by name, the version is of the one we'd run
+    std::string version = workerToolVersion(cmd.substr(0, cmd.find(' ')));
+    if (version.empty()) return false;
+    std::string ext = std::path(source).extension().string();
+    WireMessage job = {{"job", ""}, {"version", version}, {"lang", ext == ".c" || ext == ".cc" ? "cpp-output" : "c++-cpp-output"}};
+    for (const std::string& a : args) job.emplace_back("arg", a);
+    if (cmd.find(" -ffile-prefix-map=") != std::string::npos) job.emplace_back("prefix", std::filesystem::current_path().string());
+    job.emplace_back("source", readFile(pp));
+    WorkerPool& pool = workerPool();
+    TraceSpan span("action", "remote compile");
+    span.arg("worker", pool.address(i));
+    bscfSocket s = connectWorker(pool.address(i), pool.timeoutSeconds);
+    WireMessage reply;
+    bool answered = s != BSCF_BAD_SOCKET && sendWireMessage(s, job) && recvWireMessage(s, reply);
+    if (s != BSCF_BAD_SOCKET) bscfCloseSocket(s);
+    if (!answered) {
+        std::lock_guard<std::mutex> lock(bscfOutputMutex);
+        std::cerr << "# Worker " << pool.address(i) << " failed or timed out, compiling " << source << " here" << std::endl;
+        return false;
+    }
+    std::string status = wireValue(reply, "status");
+    span.arg("status", status);
+    if (status == "refused") {
+        pool.retire(i);
+        std::lock_guard<std::mutex> lock(bscfOutputMutex);
+        std::cerr << "# Worker " << pool.address(i) << " refused the job (" << wireValue(reply, "reason") << "), not using it" << std::endl;
+        return false;
+    }
+    writeFileAtomic(errFile, wireValue(reply, "stderr"));
+    ok = status == "0";
+    if (ok && !writeFileAtomic(object, wireValue(reply, "object"))) return false;
+    return true;
+}
+
+// the worker side
+
+struct WorkerState {
+    std::path dir; // scratch files of the jobs
+    size_t slots;
+    size_t running = 0;
+    std::mutex mutex;
+    std::condition_variable slotFree;
+    std::atomic<long long> jobs{0};
+    int delaySeconds = 0;
+    long long crashAfter = 0;
+};
+
+void serveWorkerJob(bscfSocket client, WorkerState* state) {
+    WireMessage message;
+    if (!recvWireMessage(client, message) || message.empty()) {
+        bscfCloseSocket(client);
+        return;
+    }
+    if (message[0].first == "hello") {
+        sendWireMessage(client, {{"slots", std::to_string(state->slots)}});
+        bscfCloseSocket(client);
+        return;
+    }
+    long long n = ++state->jobs;
+    if (state->crashAfter > 0 && n >= state->crashAfter) {
+        std::cerr << "Worker crashing on job " << n << " (BSCF_WORKER_CRASH_AFTER)" << std::endl;
+        _exit(1);
+    }
+    std::vector<std::string> args;
+    for (const auto& [name, value] : message) {
+        if (name == "arg") args.push_back(value);
+    }
+    WireMessage reply;
+    std::string tool = args.empty() ? "" : args[0];
+    std::string version = workerToolAllowed(tool) ? workerToolVersion(tool) : "";
+    if (args.empty() || !workerToolAllowed(tool)) {
+        reply = {{"status", "refused"}, {"reason", "not a compiler this worker runs"}};
+    } else if (version.empty()) {
+        reply = {{"status", "refused"}, {"reason", tool + " is not installed on the worker"}};
+    } else if (version != wireValue(message, "version")) {
+        reply = {{"status", "refused"}, {"reason", "another version of " + tool}};
+    } else if (!std::all_of(args.begin() + 1, args.end(), workerArgAllowed) ||
+               (wireValue(message, "lang") != "cpp-output" && wireValue(message, "lang") != "c++-cpp-output")) {
+        reply = {{"status", "refused"}, {"reason", "a flag this worker doesn't pass on"}};
+    } else {
+        // never whatever is first in the worker's cwd or named by the job, only the one in PATH
+        args[0] = workerToolPath(tool);
+        if (state->delaySeconds > 0) std::this_thread::sleep_for(std::chrono::seconds(state->delaySeconds));
+        {
+            std::unique_lock<std::mutex> lock(state->mutex);
+            state->slotFree.wait(lock, [state] { return state->running < state->slots; });
+            state->running++;
+        }
+        std::string base = (state->dir / std::to_string(n)).string();
+        writeFileAtomic(base + ".src", wireValue(message, "source"));
+        // the coordinator maps its directory to . in the debug info, this does the same for it and for ours
+        // (a flag made here, passed as an argument and not through a shell, whatever the prefix is it only names a prefix)
+        std::string prefix = wireValue(message, "prefix");
+        if (!prefix.empty()) {
+            args.push_back("-fdebug-prefix-map=" + prefix + "=.");
+            args.push_back("-fdebug-prefix-map=" + std::filesystem::current_path().string() + "=.");
+        }
+        args.insert(args.end(), {"-x", wireValue(message, "lang"), "-c", base + ".src", "-o", base + ".o"});
+        int status = runArgs(args, base + ".err");
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->running--;
+        }
+        state->slotFree.notify_one();
+        {
+            std::lock_guard<std::mutex> lock(bscfOutputMutex);
+            std::cout << "job " << n << ": " << (status == 0 ? "compiled" : "failed") << std::endl;
+        }
+        reply = {{"status", std::to_string(status)}, {"stderr", readFile(base + ".err")}};
+        if (status == 0) reply.emplace_back("object", readFile(base + ".o"));
+        for (const char* ext : {".src", ".err", ".o"}) std::filesystem::remove(base + ext);
+    }
+    sendWireMessage(client, reply);
+    bscfCloseSocket(client);
+}
+
+// bscf . worker [address], runs until killed
+int runWorker(std::string address, size_t slots) {
+#ifdef _WIN32
+    std::cerr << "Error: bscf worker needs a unix system" << std::endl;
+    return 1;
+#else
+    netInit();
+    bscfSocket server;
+    if (address.rfind("unix:", 0) == 0) {
+        server = netListenUnix(address.substr(5));
+    } else {
+        int port = BSCF_DEFAULT_WORKER_PORT;
+        if (!address.empty()) {
+            try {
+                port = std::stoi(address.substr(address.rfind(':') == std::string::npos ? 0 : address.rfind(':') + 1));
+            } catch (...) {
+                std::cerr << "Error: invalid worker address " << address << std::endl;
+                return 1;
+            }
+        }
+        server = netListenLocal(port);
+        address = "127.0.0.1:" + std::to_string(port);
+    }
+    if (server == BSCF_BAD_SOCKET) {
+        std::cerr << "Error: could not listen on " << address << std::endl;
+        return 1;
+    }
+    static WorkerState state;
+    state.slots = std::max<size_t>(1, slots);
+    state.dir = std::filesystem::temp_directory_path() / ("bscf-worker-" + std::to_string(getpid()));
+    std::create_directories(state.dir);
+    if (const char* delay = std::getenv("BSCF_WORKER_DELAY")) state.delaySeconds = std::atoi(delay);
+    if (const char* crash = std::getenv("BSCF_WORKER_CRASH_AFTER")) state.crashAfter = std::atoll(crash);
+    std::cout << "Worker on " << address << " with " << state.slots << " slots" << std::endl;
+    std::cout << "Use it with BSCF_WORKERS=" << address << std::endl;
+    while (true) {
+        bscfSocket client = accept(server, nullptr, nullptr);
+        if (client == BSCF_BAD_SOCKET) continue;
+        setSocketTimeout(client, 600);
+        std::thread(serveWorkerJob, client, &state).detach();
+    }
+#endif
+}
+
+#endif //SRC_WORKERS_H